@@ -9,12 +9,29 @@
 #include "adm.h"
 #include "adm_file_loader.h"
 #include "dat_file_adm_loader.h"
+#include "dat_file_writer.h"
 #include "filename_utils.h"
 #include "unicode.h"
 
 namespace tlmodder {
 namespace adm {
 
+StringMap::StringMap(StringMap const& other):
+	m_stringToId(other.m_stringToId),
+	m_nextId(other.m_nextId)
+{
+	for (auto const& entry : m_stringToId)
+		m_idToString.insert(m_idToString.end(), std::make_pair(entry.second, &entry.first));
+}
+
+StringMap& StringMap::operator=(StringMap const& other)
+{
+	if (this != &other)
+		*this = StringMap(other);
+	
+	return *this;
+}
+
 uint32_t StringMap::add(std::string str)
 {
 	StringToId::iterator it = m_stringToId.lower_bound(str);
@@ -148,84 +165,15 @@ void Adm::mergeNodeAttributes(
 	}
 }
 
-void Adm::dumpAttributes(
-	std::ostream& strm,
-	Node const& node) const
+void Adm::dump(std::ostream& strm) const
 {
-	for (auto& attribute : node.attributes)
-	{
-		std::string const& name = getString(attribute.first);
-		
-		switch (attribute.second.type)
-		{
-			case AttributeValue::TYPE_INT:
-				strm << "<INTEGER>" << name << ":" << attribute.second.vali32;
-				break;
-			case AttributeValue::TYPE_FLOAT:
-				strm << "<FLOAT>" << name << ":" << attribute.second.valf;
-				break;
-			case AttributeValue::TYPE_DOUBLE:
-				strm << "<DOUBLE>" << name << ":" << attribute.second.vald;
-				break;
-			case AttributeValue::TYPE_UINT:
-				strm << "<UNSIGNED INT>" << name << ":" << attribute.second.valu32;
-				break;
-			case AttributeValue::TYPE_STRING:
-				strm << "<STRING>" << name << ":" << getString(attribute.second.valu32);
-				break;
-			case AttributeValue::TYPE_BOOL:
-				strm << "<BOOL>" << name << ":" << (attribute.second.valu32 != 0 ? "true" : "false");
-				break;
-			case AttributeValue::TYPE_INT64:
-				strm << "<INTEGER64>" << name << ":" << attribute.second.vali64;
-				break;
-			case AttributeValue::TYPE_TRANSLATE:
-				strm << "<TRANSLATE>" << name << ":" << getString(attribute.second.valu32);
-				break;
-		}
-		
-		strm << std::endl;
-	}
-}
-
-void Adm::dumpNode(
-	std::ostream& strm,
-	Node const& sourceNode) const
-{
-	using SourcePair = std::pair<Node const*, NodeConstIterator>;
-	using SourceStack = std::stack<SourcePair>;
-	
-	SourceStack sourceStack;
-	sourceStack.push(std::make_pair(&sourceNode, sourceNode.subnodes.begin()));
-	
-	while (!sourceStack.empty())
-	{
-		SourcePair& source = sourceStack.top();
-		Node const& node = *source.first;
-		
-		if (source.second == node.subnodes.begin())
-		{
-			strm << "[" << getString(node.name) << "]" << std::endl;
-			dumpAttributes(strm, node);
-		}
-		
-		if (source.second != node.subnodes.end())
-		{
-			Node const& childNode = *source.second;
-			sourceStack.push(std::make_pair(&childNode, childNode.subnodes.begin()));
-			++source.second;
-		}
-		else
-		{
-			strm << "[/" << getString(node.name) << "]" << std::endl;
-			sourceStack.pop();
-		}
-	}
+	datFileWrite(strm, *this);
 }
 
-void Adm::loadFromDat(std::string const& fn)
+void Adm::loadFromDat(std::string const& fn, std::ostream& log)
 {
 	DatFileLoader loader(fn);
+	loader.log(log);
 	loader.load(*this);
 }
 
@@ -235,13 +183,14 @@ void Adm::loadFromAdm(std::string const& fn)
 	loader.load(*this);
 }
 
-void Adm::loadFromFile(std::string const& fn)
+void Adm::loadFromFile(std::string const& fn, std::ostream& log)
 {
-	string ext = utf8_to_upper(FileName::extension(fn));
+	string ext = FileName::extension(fn);
+	utf8_to_upper_inplace(ext);
 	if (ext == "ADM")
 		loadFromAdm(fn);
 	else if (ext == "DAT" || ext == "LAYOUT" || ext == "ANIMATION" || ext == "HIE")
-		loadFromDat(fn);
+		loadFromDat(fn, log);
 	else
 		throw std::runtime_error("I don't know how to load Adm from this :(");
 }
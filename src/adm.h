@@ -122,6 +122,13 @@ public:
 	StringMap(): m_nextId(0x1000)
 	{}
 	
+	// m_idToString points into m_stringToId, so it is rebuilt by copy
+	StringMap(StringMap const& other);
+	StringMap(StringMap&&) = default;
+	
+	StringMap& operator=(StringMap const& other);
+	StringMap& operator=(StringMap&&) = default;
+	
 	uint32_t add(std::string str);
 	std::string const& get(uint32_t id) const;
 	
@@ -173,24 +180,25 @@ public:
 	{ return m_root; }
 	
 	
-	void loadFromFile(std::string const& fn);
+	// Warnings found while loading DAT files are written into log
+	void loadFromFile(std::string const& fn, std::ostream& log = std::cerr);
 	
-	void loadFromDat(std::string const& fn);
+	void loadFromDat(std::string const& fn, std::ostream& log = std::cerr);
 	void loadFromAdm(std::string const& fn);
 	
 	void loadFromDat(std::istream& strm);
 	void loadFromAdm(std::istream& strm);
 	
-	static AdmPtr createFromFile(std::string const& fn)
+	static AdmPtr createFromFile(std::string const& fn, std::ostream& log = std::cerr)
 	{
 		AdmPtr ptr = std::make_shared<Adm>();
-		ptr->loadFromFile(fn);
+		ptr->loadFromFile(fn, log);
 		return ptr;
 	}
 	
 	
-	void dump(std::ostream& strm) const
-	{ dumpNode(strm, m_root); }
+	// Writes UTF-8 DAT representation, see datFileWrite()
+	void dump(std::ostream& strm) const;
 	
 	StringMap const& stringMap() const
 	{ return m_stringMap; }
@@ -219,9 +227,6 @@ public:
 	{
 		return AttributeValue(AttributeValue::TYPE_TRANSLATE, addString(std::move(value)));
 	}
-protected:
-	void dumpNode(std::ostream& strm, Node const& node) const;
-	void dumpAttributes(std::ostream& strm, Node const& node) const;
 };
 
 class Loader
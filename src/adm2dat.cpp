@@ -9,42 +9,52 @@
 #include "adm.h"
 #include "adm_file_loader.h"
 #include "dat_file_adm_loader.h"
+#include "dat_file_writer.h"
 
 #include <iostream>
-#include <fstream>
+#include <string>
 
 using std::cout;
 using std::endl;
 
+using tlmodder::UnicodeEncoding;
 using tlmodder::adm::Adm;
 using tlmodder::adm::AdmFileLoader;
+using tlmodder::adm::datFileWrite;
 
 int main(int argc, const char**argv)
 {
-	if (argc < 2)
+	UnicodeEncoding encoding = UnicodeEncoding::UTF_8;
+	int argi = 1;
+	
+	if (argc > 1 && std::string(argv[1]) == "--utf16")
+	{
+		encoding = UnicodeEncoding::UTF_16LE;
+		argi = 2;
+	}
+	
+	if (argc - argi < 1)
 	{
-		std::cerr << "Usage: " << argv[0] << "input_file [output_file]" << endl;
+		std::cerr << "Usage: " << argv[0] << " [--utf16] input_file [output_file]" << endl;
 		std::cerr << "If output file is not specified, stdout will be used" << endl;
+		std::cerr << "With --utf16, output is UTF-16LE with BOM instead of UTF-8" << endl;
 		return 0;
 	}
 	
 	Adm adm;
 	{
-		AdmFileLoader loader(argv[1]);
+		AdmFileLoader loader(argv[argi]);
 		loader.load(adm);
 	}
 	
-	if (argc > 2)
+	if (argc - argi > 1)
 	{
-		std::ofstream strm;
-		strm.exceptions(std::ios::badbit | std::ios::failbit);
-		strm.open(argv[2], std::ios::trunc);
-		adm.dump(strm);
-		strm.close();
+		datFileWrite(argv[argi+1], adm, encoding);
 	}
 	else
 	{
-		adm.dump(cout);
+		datFileWrite(cout, adm, encoding);
+		cout.flush();
 	}
 	
 	return 0;
@@ -86,11 +86,11 @@ struct LoadState
 
 
 AdmFileLoader::AdmFileLoader(std::string const& file):
-	m_file(file)
+	m_file(file, MappedFile::POPULATE)
 {}
 
 AdmFileLoader::AdmFileLoader(DirIterator const& dir, std::string const& file):
-	m_file(dir, file)
+	m_file(dir, file, MappedFile::POPULATE)
 {}
 
 void AdmFileLoader::load(Adm& adm)
@@ -23,7 +23,7 @@ using namespace ::std;
 static void admFileWriteStringmap(std::ostream& strm, Adm const& adm);
 static void admFileWriteTree(std::ostream& strm, Adm const& adm);
 
-void admFileWrite(std::string const& filename, Adm const& adm)
+void admFileWrite(char const* filename, Adm const& adm)
 {
 	ofstream strm;
 	strm.exceptions(ostream::failbit | ostream::badbit);
@@ -48,7 +48,6 @@ void admFileWriteStringmap(std::ostream& strm, Adm const& adm)
 	uint32_t num;
 	vector<char16_t> utf16buf;
 	size_t len;
-	char32_t chr;
 	
 	// Write number of strings, no overflow possible here since key is uint32_t
 	num = (uint32_t)adm.stringMap().idToString().size();
@@ -57,16 +56,13 @@ void admFileWriteStringmap(std::ostream& strm, Adm const& adm)
 	// Now for each string its id and length and the string
 	for (auto& entry : adm.stringMap().idToString())
 	{
-		utf8_iterator iter(*entry.second);
-		len = 0;
+		string const& str = *entry.second;
 		
-		while (iter.next(chr))
-		{
-			if (len + 2 > utf16buf.size())
-				utf16buf.resize(utf16buf.size()+64);
-				
-			len += utf32chr_to_utf16(chr, &utf16buf[len]);
-		}
+		// UTF-16 string never has more code units than UTF-8 one has bytes
+		if (str.size() > utf16buf.size())
+			utf16buf.resize(str.size());
+		
+		len = utf8_to_utf16(str.data(), str.size(), utf16buf.data());
 		
 		// ID
 		num = entry.first;
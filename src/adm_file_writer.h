@@ -16,7 +16,10 @@ namespace tlmodder {
 namespace adm {
 
 void admFileWrite(std::ostream& strm, Adm const& adm);
-void admFileWrite(std::string const& filename, Adm const& adm);
+void admFileWrite(char const* filename, Adm const& adm);
+
+inline void admFileWrite(std::string const& filename, Adm const& adm)
+{ admFileWrite(filename.c_str(), adm); }
 
 }
 }
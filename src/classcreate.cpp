@@ -40,7 +40,7 @@ void loadConfig(std::string const& fn)
 void loadGameData()
 {
 	try {
-		g_gameData.loadFromDir(g_config.originalGameData());
+		g_gameData.loadFromDir(g_config.originalGameData(), g_config.scanCacheDir());
 	}
 	catch (DirIterator::OpenFailed& e)
 	{
@@ -105,7 +105,7 @@ void createClassDatFile()
 	createDirWithParents(modDir.str());
 	
 	adm::Adm adm;
-	adm.loadFromFile(it->second.front());
+	adm.loadFromFile(it->second.front().path());
 	
 	adm.root().setAttribute(
 		adm.addString("NAME"),
@@ -147,7 +147,7 @@ void maybeCreateItem(ModFileEntry const& file, FileName const& modDir)
 	bool inserted;
 	
 	try {
-		adm.loadFromFile(file.second.front());
+		adm.loadFromFile(file.second.front().path());
 	}
 	catch (...)
 	{ return; }
@@ -188,7 +188,7 @@ void maybeCreateItem(ModFileEntry const& file, FileName const& modDir)
 	
 	// Merge wardrobes from previous mods
 	{
-		std::list<string>::const_iterator fileIt, fileItEnd;
+		ModSource const *fileIt, *fileItEnd;
 		uint32_t WARDROBE_id, CLASS_id;
 		
 		fileIt = file.second.begin();
@@ -199,7 +199,7 @@ void maybeCreateItem(ModFileEntry const& file, FileName const& modDir)
 			adm::Adm prevAdm;
 			
 			try {
-				prevAdm.loadFromFile(*fileIt);
+				prevAdm.loadFromFile(fileIt->path());
 			}
 			catch (...)
 			{ continue; }
@@ -17,6 +17,12 @@ void Config::setDefaults()
 	m_modDir = "./mods";
 	m_originalGameData = "./original";
 	m_outputDir = "./output";
+	m_scanCacheDir = "./cache";
+	m_prefetchDistance = 64;
+	m_compileThreads = 0;
+	m_ioUring = false;
+	m_preserveAttributes = false;
+	m_linkAssets = false;
 }
 
 void Config::loadFrom(std::string const& fn)
@@ -24,8 +30,9 @@ void Config::loadFrom(std::string const& fn)
 	adm::Adm config;
 	adm::AttributeIterator attr;
 	uint32_t PRIORITY_id, NAME_id, ENABLED_id, MOD_id;
-	uint32_t MOD_DIR_id, ORIGINAL_GAME_DATA_id, OUTPUT_DIR_id;
-	uint32_t MERGE_CLASS_MODS_id, LOOK_FOR_NEW_id;
+	uint32_t MOD_DIR_id, ORIGINAL_GAME_DATA_id, OUTPUT_DIR_id, SCAN_CACHE_DIR_id, PREFETCH_DISTANCE_id;
+	uint32_t COMPILE_THREADS_id;
+	uint32_t MERGE_CLASS_MODS_id, LOOK_FOR_NEW_id, IO_URING_id, PRESERVE_ATTRIBUTES_id, LINK_ASSETS_id;
 	
 	setDefaults();
 	config.loadFromDat(fn);
@@ -36,9 +43,15 @@ void Config::loadFrom(std::string const& fn)
 	MOD_DIR_id = config.addString("MOD_DIR");
 	ORIGINAL_GAME_DATA_id = config.addString("ORIGINAL_GAME_DATA");
 	OUTPUT_DIR_id = config.addString("OUTPUT_DIR");
+	SCAN_CACHE_DIR_id = config.addString("SCAN_CACHE_DIR");
+	PREFETCH_DISTANCE_id = config.addString("PREFETCH_DISTANCE");
+	COMPILE_THREADS_id = config.addString("COMPILE_THREADS");
 	
 	MERGE_CLASS_MODS_id = config.addString("MERGE_CLASS_MODS");
 	LOOK_FOR_NEW_id = config.addString("LOOK_FOR_NEW");
+	IO_URING_id = config.addString("IO_URING");
+	PRESERVE_ATTRIBUTES_id = config.addString("PRESERVE_ATTRIBUTES");
+	LINK_ASSETS_id = config.addString("LINK_ASSETS");
 	
 	PRIORITY_id = config.addString("PRIORITY");
 	NAME_id = config.addString("NAME");
@@ -69,6 +82,27 @@ void Config::loadFrom(std::string const& fn)
 			else
 				std::cerr << "WARNING: attribute OUTPUT_DIR should be of type STRING" << std::endl;
 		}
+		else if (attribute.first == SCAN_CACHE_DIR_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_STRING)
+				m_scanCacheDir = config.getString(attribute.second.valu32);
+			else
+				std::cerr << "WARNING: attribute SCAN_CACHE_DIR should be of type STRING" << std::endl;
+		}
+		else if (attribute.first == PREFETCH_DISTANCE_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_UINT)
+				m_prefetchDistance = attribute.second.valu32;
+			else
+				std::cerr << "WARNING: attribute PREFETCH_DISTANCE should be of type UNSIGNED INT" << std::endl;
+		}
+		else if (attribute.first == COMPILE_THREADS_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_UINT)
+				m_compileThreads = attribute.second.valu32;
+			else
+				std::cerr << "WARNING: attribute COMPILE_THREADS should be of type UNSIGNED INT" << std::endl;
+		}
 		else if (attribute.first == MERGE_CLASS_MODS_id)
 		{
 			if (attribute.second.type == adm::AttributeValue::TYPE_BOOL)
@@ -83,6 +117,27 @@ void Config::loadFrom(std::string const& fn)
 			else
 				std::cerr << "WARNING: attribute LOOK_FOR_NEW should be of type BOOL" << std::endl;
 		}
+		else if (attribute.first == IO_URING_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_BOOL)
+				m_ioUring = attribute.second.valu32 != 0 ? true : false;
+			else
+				std::cerr << "WARNING: attribute IO_URING should be of type BOOL" << std::endl;
+		}
+		else if (attribute.first == PRESERVE_ATTRIBUTES_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_BOOL)
+				m_preserveAttributes = attribute.second.valu32 != 0 ? true : false;
+			else
+				std::cerr << "WARNING: attribute PRESERVE_ATTRIBUTES should be of type BOOL" << std::endl;
+		}
+		else if (attribute.first == LINK_ASSETS_id)
+		{
+			if (attribute.second.type == adm::AttributeValue::TYPE_BOOL)
+				m_linkAssets = attribute.second.valu32 != 0 ? true : false;
+			else
+				std::cerr << "WARNING: attribute LINK_ASSETS should be of type BOOL" << std::endl;
+		}
 		else
 		{
 			std::cerr << "WARNING: ignoring unknown attribute " << config.getString(attribute.first) << std::endl;
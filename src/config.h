@@ -72,6 +72,24 @@ public:
 	
 	std::string const& outputDir() const
 	{ return m_outputDir; }
+	
+	std::string const& scanCacheDir() const
+	{ return m_scanCacheDir; }
+	
+	unsigned prefetchDistance() const
+	{ return m_prefetchDistance; }
+	
+	unsigned compileThreads() const
+	{ return m_compileThreads; }
+	
+	bool ioUring() const
+	{ return m_ioUring; }
+	
+	bool preserveAttributes() const
+	{ return m_preserveAttributes; }
+	
+	bool linkAssets() const
+	{ return m_linkAssets; }
 protected:
 	ModConfigSet m_modConfigs;
 	bool m_lookForNew;
@@ -79,6 +97,12 @@ protected:
 	std::string m_modDir;
 	std::string m_originalGameData;
 	std::string m_outputDir;
+	std::string m_scanCacheDir;
+	unsigned m_prefetchDistance;
+	unsigned m_compileThreads;
+	bool m_ioUring;
+	bool m_preserveAttributes;
+	bool m_linkAssets;
 };
 
 }
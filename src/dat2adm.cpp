@@ -11,6 +11,11 @@
 #include "adm_file_writer.h"
 
 #include <iostream>
+#include <limits>
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 using std::string;
 using tlmodder::adm::Adm;
@@ -18,17 +23,45 @@ using tlmodder::adm::DatFileLoader;
 
 int main(int argc, const char**argv)
 {
-	if (argc < 2)
+	unsigned threads = 0;
+	int argi = 1;
+	bool badArgs = false;
+	
+	// 0 threads means number of CPUs, same as the default
+	if (argc > 1 && string(argv[1]) == "-j")
 	{
-		std::cerr << "Usage: " << argv[0] << "input_file [output_file]" << std::endl;
-		return 0;
+		char const* str = argc > 2 ? argv[2] : "";
+		char* end;
+		unsigned long value;
+		
+		// strtoul() would accept leading spaces and sign
+		errno = 0;
+		value = ::strtoul(str, &end, 10);
+		
+		if (!isdigit((unsigned char)*str) || *end != '\0' || errno != 0 ||
+		    value > std::numeric_limits<unsigned>::max())
+			badArgs = true;
+		else
+			threads = (unsigned)value;
+		
+		argi = 3;
 	}
 	
-	string input_file = argv[1];
+	if (badArgs || argc - argi < 1)
+	{
+		std::cerr << "Usage: " << argv[0] << " [-j threads] input_file [output_file]" << std::endl;
+		std::cerr << "Use - as input_file to read standard input and as output_file to write to stdout."
+		          << std::endl;
+		return badArgs ? 1 : 0;
+	}
+	
+	string input_file = argv[argi];
 	string output_file;
 	
-	if (argc > 2)
-		output_file = argv[2];
+	if (argc - argi > 1)
+		output_file = argv[argi+1];
+	else if (input_file == "-")
+		output_file = "-"; // work as filter
 	else
 		output_file = input_file + ".adm";
 	
@@ -36,15 +69,33 @@ int main(int argc, const char**argv)
 	
 	try
 	{
-		DatFileLoader loader(input_file);
-		loader.load(adm);
+		if (input_file == "-")
+		{
+			DatFileLoader loader(STDIN_FILENO);
+			loader.threads(threads);
+			loader.load(adm);
+		}
+		else
+		{
+			DatFileLoader loader(input_file);
+			loader.threads(threads);
+			loader.load(adm);
+		}
 	}
 	catch (DatFileLoader::Exception& e)
 	{
 		std::cerr << e.format() << std::endl;
 	}
 	
-	admFileWrite(output_file, adm);
+	if (output_file == "-")
+	{
+		admFileWrite(std::cout, adm);
+		std::cout.flush();
+	}
+	else
+	{
+		admFileWrite(output_file, adm);
+	}
 	
 	return 0;
 }
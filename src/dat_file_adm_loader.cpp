@@ -8,189 +8,639 @@
 
 #include "dat_file_adm_loader.h"
 
-#include <stack>
-#include <limits>
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <exception>
+#include <limits>
 #include <sstream>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace tlmodder {
 namespace adm {
 
-enum class UnicodeEncoding {
-	UTF_8,
-	UTF_16LE,
-	UTF_16BE,
-	UTF_32LE,
-	UTF_32BE,
-	UNKNOWN
-};
-
 DatFileLoader::DatFileLoader(std::string const& file):
-	m_file(file),
-	m_flags(0)
+	m_flags(0),
+	m_threads(1),
+	m_log(&std::cerr),
+	m_encoding(UnicodeEncoding::UNKNOWN),
+	m_data(nullptr),
+	m_size(0)
 {
-	_detectEncoding();
+	_open(::open(file.c_str(), O_RDONLY | O_CLOEXEC), true);
 }
 
 DatFileLoader::DatFileLoader(DirIterator const& dir, std::string const& file):
-	m_file(dir, file),
-	m_flags(0)
+	m_flags(0),
+	m_threads(1),
+	m_log(&std::cerr),
+	m_encoding(UnicodeEncoding::UNKNOWN),
+	m_data(nullptr),
+	m_size(0)
 {
-	_detectEncoding();
+	_open(dir.open(file, O_RDONLY | O_CLOEXEC), true);
 }
 
-void DatFileLoader::_detectEncoding()
+DatFileLoader::DatFileLoader(int fd):
+	m_flags(0),
+	m_threads(1),
+	m_log(&std::cerr),
+	m_encoding(UnicodeEncoding::UNKNOWN),
+	m_data(nullptr),
+	m_size(0)
 {
-	uint8_t const* data = m_file.ptr();
-	size_t size = m_file.size();
-	UnicodeEncoding encoding = UnicodeEncoding::UNKNOWN;
+	_open(fd, false);
+}
+
+void DatFileLoader::_open(int fd, bool closeFd)
+{
+	struct stat st;
 	
-	// NOTE: support for UTF-32 can be added, but I am too lazy ^^
+	if (fd == -1)
+		throw MappedFile::MappingFailed("cannot open file");
 	
-	// Detect encoding based on BOM, if present
-	if (size > 2 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf)
+	if (::fstat(fd, &st) != 0)
 	{
-		data += 3;
-		size -= 3;
-		encoding = UnicodeEncoding::UTF_8;
+		if (closeFd)
+			::close(fd);
+		throw MappedFile::MappingFailed("fstat() failed");
 	}
-	else if (size > 1 && data[0] == 0xfe && data[1] == 0xff)
+	
+	// Pipes, terminals and such cannot be mapped, read them in chunks
+	if (!S_ISREG(st.st_mode))
 	{
-		data += 2;
-		size -= 2;
-		encoding = UnicodeEncoding::UTF_16BE;
+		m_stream.reset(new stream_buffer(fd, closeFd));
+		m_encoding = m_stream->encoding();
+		return;
+	}
+	
+	// FIXME: check if file size negative or value too large to cast to size_t
+	try {
+		m_file.reset(new MappedFile(fd, (size_t)st.st_size, MappedFile::POPULATE));
 	}
-	else if (size > 1 && data[0] == 0xff && data[1] == 0xfe)
+	catch (...)
 	{
-		data += 2;
-		size -= 2;
-		encoding = UnicodeEncoding::UTF_16LE;
+		if (closeFd)
+			::close(fd);
+		throw;
 	}
 	
-	if (encoding == UnicodeEncoding::UNKNOWN)
+	if (closeFd)
+		::close(fd);
+	
+	_detectEncoding();
+}
+
+void DatFileLoader::_detectEncoding()
+{
+	uint8_t const* data = m_file->ptr();
+	size_t size = m_file->size();
+	size_t bomSize;
+	
+	m_encoding = detect_encoding(data, size, bomSize);
+	m_data = data + bomSize;
+	m_size = size - bomSize;
+}
+
+// One parsed non-empty line of DAT file. Lines are tokenized independently of each
+// other, section nesting is checked when the records are applied in order.
+struct DatFileLoader::Record
+{
+	enum Kind {
+		NONE,          // empty line or comment
+		SECTION_OPEN,
+		SECTION_CLOSE,
+		ATTRIBUTE,
+		ERROR          // malformed line, error holds the reason
+	};
+	
+	Kind kind;
+	size_t lineNum;
+	bool missingBracket;
+	size_t invalidUtf8Column;         // column of invalid UTF-8 sequence, 0 if none
+	string name;                      // section or attribute name
+	AttributeValue value;
+	string strValue;                  // value of STRING and TRANSLATE attributes
+	ExceptionPtr error;
+	std::exception_ptr errorToThrow;  // same as error, rethrown with its dynamic type
+	
+	template<typename ExceptionType>
+	void setError(ExceptionType&& e)
 	{
-		// No BOM, try to guess based on file content
-		// Since valid DAT files should start with ASCII character, we
-		// can guess by looking for zero byte at #0 (big endian) or #1 (little endian)
-		// if we don't find it, assume UTF-8
-		
-		// NOTE: should one want to default to something else, here is the right place
-		//       to do it
+		using ErrorType = typename std::decay<ExceptionType>::type;
 		
-		if (size > 1 && data[0] == 0x00)
-			encoding = UnicodeEncoding::UTF_16BE;
-		else if (size > 1 && data[1] == 0x00)
-			encoding = UnicodeEncoding::UTF_16LE;
-		else
-			encoding = UnicodeEncoding::UTF_8;
+		kind = ERROR;
+		errorToThrow = std::make_exception_ptr(e);
+		error = std::make_shared<ErrorType>(std::forward<ExceptionType>(e));
+	}
+};
+
+struct DatFileLoader::ParseState
+{
+	struct OpenSection
+	{
+		Node* node;
+		size_t lineNum;
+	};
+	
+	Adm& adm;
+	ErrorList* errors;
+	std::vector<OpenSection> nodeStack;
+	Node extraRoot;
+	bool hasRoot;
+	
+	ParseState(Adm& adm_, ErrorList* errors_):
+		adm(adm_),
+		errors(errors_),
+		hasRoot(false)
+	{}
+};
+
+template<typename ExceptionType>
+void DatFileLoader::_fail(ErrorList* errors, ExceptionType&& e)
+{
+	using ErrorType = typename std::decay<ExceptionType>::type;
+	
+	if (errors == nullptr)
+		throw e;
+	
+	errors->push_back(std::make_shared<ErrorType>(std::forward<ExceptionType>(e)));
+}
+
+void DatFileLoader::load(Adm& adm)
+{
+	_load(adm, nullptr);
+}
+
+bool DatFileLoader::check(Adm& adm, ErrorList& errors)
+{
+	size_t numErrors = errors.size();
+	
+	_load(adm, &errors);
+	
+	for (size_t i = numErrors; i < errors.size(); ++i)
+	{
+		if (!errors[i]->isWarning())
+			return false;
 	}
 	
-	switch (encoding)
+	return true;
+}
+
+void DatFileLoader::threads(unsigned numThreads)
+{
+	m_threads = numThreads;
+}
+
+// When errors is not null, errors are collected there instead of being thrown
+// and parsing continues. Malformed lines are skipped, wrong closing section
+// closes the section with that name if it is open (or the innermost one if not),
+// second root section is parsed into throw-away node.
+void DatFileLoader::_load(Adm& adm, ErrorList* errors)
+{
+	ParseState state(adm, errors);
+	
+	switch (m_encoding)
 	{
 		case UnicodeEncoding::UTF_8:
-			m_lineReader = LineReaderPtr(
-				new utf8_line_reader((char const*)data, size)
-			);
+			_load<utf8_t>(state);
+			break;
+		case UnicodeEncoding::UTF_16LE:
+			_load<utf16_le_t>(state);
 			break;
 		case UnicodeEncoding::UTF_16BE:
-			m_lineReader = LineReaderPtr(
-				new utf16_line_reader<utf16_be_t>((char16_t const*)data, size / 2)
-			);
+			_load<utf16_be_t>(state);
 			break;
-		case UnicodeEncoding::UTF_16LE:
-			m_lineReader = LineReaderPtr(
-				new utf16_line_reader<utf16_le_t>((char16_t const*)data, size / 2)
-			);
+		case UnicodeEncoding::UTF_32LE:
+			_load<utf32_le_t>(state);
+			break;
+		case UnicodeEncoding::UTF_32BE:
+			_load<utf32_be_t>(state);
 			break;
 		default:
 			throw std::runtime_error("Ups, invalid encoding");
 	}
 }
 
-// FIXME: this needs little cleanup ^^
+template<typename encoding_tag>
+void DatFileLoader::_load(ParseState& state)
+{
+	using unit_type = typename unicode_encoding<encoding_tag>::unit_type;
+	
+	unsigned numThreads = m_threads;
+	
+	if (m_stream)
+	{
+		_loadLines(state, stream_line_reader<encoding_tag>(*m_stream));
+		return;
+	}
+	
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	
+	if (numThreads > 1 && m_size >= PARALLEL_MIN_SIZE)
+	{
+		_loadParallel<encoding_tag>(state, numThreads);
+		return;
+	}
+	
+	_loadLines(state, unicode_line_reader<encoding_tag>((unit_type const*)m_data, m_size / sizeof(unit_type)));
+}
 
-void DatFileLoader::load(Adm& adm)
+template<typename LineReader>
+void DatFileLoader::_loadLines(ParseState& state, LineReader&& reader)
 {
-	std::stack<Node*> nodeStack;
+	Record record;
 	string line;
 	size_t lineNum;
-	string::size_type closingBracketPos;
-	string::size_type lineStart;
-	bool hasRoot = false;
 	
-	for (lineNum = 1; m_lineReader->read_line(line); ++lineNum)
+	for (lineNum = 1; reader.read_line(line); ++lineNum)
 	{
-		lineStart = 0;
+		_tokenize(line, lineNum, record);
+		_apply(state, record);
+	}
+	
+	_finish(state, lineNum);
+}
+
+// Tokenizes chunks of the file in parallel and applies the records in order
+template<typename encoding_tag>
+void DatFileLoader::_loadParallel(ParseState& state, unsigned numThreads)
+{
+	using RecordList = std::vector<Record>;
+	using encoding   = unicode_encoding<encoding_tag>;
+	using unit_type  = typename encoding::unit_type;
+	
+	struct Chunk
+	{
+		uint8_t const* data;
+		size_t size;
+		size_t numLines;
+		RecordList records;
+	};
+	
+	std::vector<Chunk> chunks;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> nextChunk(0);
+	size_t unitSize, numUnits, numChunks, chunkUnits, begin, end;
+	size_t lineNum;
+	
+	unitSize = sizeof(unit_type);
+	numUnits = m_size / unitSize;
+	
+	// Few chunks per thread to balance uneven lines
+	numChunks = std::min<size_t>(numThreads * 4, std::max<size_t>(1, m_size / PARALLEL_MIN_CHUNK));
+	chunkUnits = numUnits / numChunks + 1;
+	
+	// Split after LF, so CR+LF pairs are never split and each chunk starts a line
+	for (begin = 0; begin < numUnits; begin = end)
+	{
+		end = std::min(begin + chunkUnits, numUnits);
+		
+		end = _findLineBreak((unit_type const*)m_data, end, numUnits, encoding::LF);
+		
+		chunks.push_back({m_data + begin * unitSize, (end - begin) * unitSize, 0, {}});
+	}
+	
+	auto worker = [&]()
+	{
+		size_t i;
 		
-		// Skip white spaces
-		for (lineStart = 0; lineStart < line.size(); ++lineStart)
+		while ((i = nextChunk.fetch_add(1)) < chunks.size())
 		{
-			if (!std::isspace(line[lineStart]))
-				break;
+			Chunk& chunk = chunks[i];
+			
+			_tokenizeChunk(unicode_line_reader<encoding_tag>((unit_type const*)chunk.data, chunk.size / unitSize),
+			               chunk.records, chunk.numLines);
 		}
+	};
+	
+	numThreads = (unsigned)std::min<size_t>(numThreads, chunks.size());
+	
+	for (unsigned i = 1; i < numThreads; ++i)
+		workers.emplace_back(worker);
+	
+	worker();
+	
+	for (std::thread& thread : workers)
+		thread.join();
+	
+	// Stitch the chunks together, fixing line numbers
+	lineNum = 1;
+	for (Chunk& chunk : chunks)
+	{
+		for (Record& record : chunk.records)
+		{
+			record.lineNum += lineNum - 1;
+			_apply(state, record);
+		}
+		
+		lineNum += chunk.numLines;
+		RecordList().swap(chunk.records);
+	}
+	
+	_finish(state, lineNum);
+}
+
+template<typename unit_type>
+size_t DatFileLoader::_findLineBreak(unit_type const* data, size_t pos, size_t size, unit_type lf)
+{
+	while (pos < size && data[pos++] != lf);
+	return pos;
+}
+
+template<typename LineReader>
+void DatFileLoader::_tokenizeChunk(LineReader&& reader, std::vector<Record>& records, size_t& numLines)
+{
+	Record record;
+	string line;
+	size_t lineNum;
+	
+	for (lineNum = 1; reader.read_line(line); ++lineNum)
+	{
+		_tokenize(line, lineNum, record);
+		
+		if (record.kind != Record::NONE)
+			records.push_back(std::move(record));
+	}
+	
+	numLines = lineNum - 1;
+}
+
+// FIXME: this needs little cleanup ^^
+
+void DatFileLoader::_tokenize(string const& line, size_t lineNum, Record& record)
+{
+	string::size_type lineStart;
+	size_t errorOffset;
+	
+	record.kind = Record::NONE;
+	record.lineNum = lineNum;
+	record.missingBracket = false;
+	record.invalidUtf8Column = 0;
+	
+	// Lines transcoded from UTF-16 and UTF-32 are always valid, this catches
+	// broken UTF-8 files
+	if (!utf8_validate(line.data(), line.size(), errorOffset))
+		record.invalidUtf8Column = errorOffset + 1;
+	
+	// Skip white spaces
+	for (lineStart = 0; lineStart < line.size(); ++lineStart)
+	{
+		if (!std::isspace(line[lineStart]))
+			break;
+	}
+	
+	// Skip empty lines
+	if (line.size() == lineStart)
+		return;
+	
+	if (line[lineStart] == '[')
+	{
+		string::size_type bracketPos;
 		
-		// Skip empty lines
-		if (line.size() == lineStart)
-			continue;
+		record.kind = Record::SECTION_OPEN;
 		
-		if (line[lineStart] == '[')
+		++lineStart;
+		
+		// If '/' is at first position of section name, it is "close the section" mark
+		if (line.size() > lineStart && line[lineStart] == '/')
 		{
-			string sectionName;
-			string::size_type bracketPos;
-			bool sectionClose = false;
-			
+			record.kind = Record::SECTION_CLOSE;
 			++lineStart;
-			
-			// If '/' is at first position of section name, it is "close the section" mark
-			if (line.size() > lineStart && line[lineStart] == '/')
-			{
-				sectionClose = true;
-				++lineStart;
-			}
-			
-			bracketPos = line.find(']', lineStart);
-			
-			if (bracketPos != string::npos)
+		}
+		
+		bracketPos = line.find(']', lineStart);
+		
+		if (bracketPos != string::npos)
+		{
+			record.name.assign(line, lineStart, bracketPos - lineStart);
+		}
+		else
+		{
+			// FIXME: treat missing ']' character as error?
+			record.missingBracket = true;
+			record.name.assign(line, lineStart, string::npos);
+		}
+		
+		// NOTE: for now ignoring anything following the ']' character and treating
+		//       that like comment
+		//       fix should come here
+	}
+	else if (line[lineStart] == '<')
+	{
+		string type_str;
+		string::size_type pos;
+		AttributeValue& value = record.value;
+		
+		record.kind = Record::ATTRIBUTE;
+		value.type = AttributeValue::TYPE_INVALID;
+		
+		++lineStart;
+		
+		// Find '>' and get value type string
+		pos = line.find('>', lineStart);
+		
+		if (pos == string::npos)
+			return record.setError(MalformedAttribute(lineNum, "missing '>' character after attribute type"));
+		
+		type_str = string(line, lineStart, pos - lineStart);
+		
+		if (type_str == "INTEGER")
+			value.type = AttributeValue::TYPE_INT;
+		else if (type_str == "FLOAT")
+			value.type = AttributeValue::TYPE_FLOAT;
+		else if (type_str == "DOUBLE")
+			value.type = AttributeValue::TYPE_DOUBLE;
+		else if (type_str == "UNSIGNED INT")
+			value.type = AttributeValue::TYPE_UINT;
+		else if (type_str == "STRING")
+			value.type = AttributeValue::TYPE_STRING;
+		else if (type_str == "BOOL")
+			value.type = AttributeValue::TYPE_BOOL;
+		else if (type_str == "INTEGER64")
+			value.type = AttributeValue::TYPE_INT64;
+		else if (type_str == "TRANSLATE")
+			value.type = AttributeValue::TYPE_TRANSLATE;
+		
+		if (value.type == AttributeValue::TYPE_INVALID)
+			return record.setError(InvalidAttributeType(lineNum, type_str));
+		
+		lineStart = pos + 1;
+		
+		pos = line.find(':', lineStart);
+		if (pos == string::npos)
+			return record.setError(MalformedAttribute(lineNum, "missing ':' character after attribute value"));
+		
+		record.name.assign(line, lineStart, pos - lineStart);
+		
+		static_assert(
+			sizeof(long long) == sizeof(int64_t),
+			"Don't know string to int64_t conversion for this platform"
+		);
+		static_assert(
+			sizeof(int) == sizeof(int32_t),
+			"Don't know string to int32_t conversion for this platform"
+		);
+		
+		try
+		{
+			switch (value.type)
 			{
-				sectionName = string(line, lineStart, bracketPos - lineStart);
+				case AttributeValue::TYPE_INT:
+					value.vali32 = std::stoi({line, pos+1});
+					break;
+				case AttributeValue::TYPE_FLOAT:
+					value.valf = std::stof({line, pos+1});
+					break;
+				case AttributeValue::TYPE_DOUBLE:
+					value.vald = std::stod({line, pos+1});
+					break;
+				case AttributeValue::TYPE_UINT:
+					{
+						// No string -> unsigned conversion in C++,
+						// string -> unsigned long used instead and range-checked
+						unsigned long valul = std::stoul({line, pos+1});
+						if (valul > std::numeric_limits<unsigned>::max())
+							throw std::out_of_range("stou");
+						
+						value.valu32 = (uint32_t)valul;
+					}
+					break;
+				case AttributeValue::TYPE_BOOL:
+					{
+						string strval = utf8_to_upper({line, pos+1});
+						
+						if (strval.compare(0, 4, "TRUE") == 0)
+							value.valu32 = 1;
+						else if (strval.compare(0, 5, "FALSE") == 0)
+							value.valu32 = 0;
+						else
+							value.valu32 = (std::stoul({line, pos+1}) == 0UL ? 0 : 1);
+					}
+					break;
+				case AttributeValue::TYPE_INT64:
+					try {
+						value.vali64 = std::stoll({line, pos+1});
+					}
+					catch (std::out_of_range&)
+					{
+						// This may trigger undefined behavior on some platforms, but it should silently
+						// overflow on x86-64 linux system with GCC compiler. Unfortunately there is no
+						// TYPE_UINT64 for attributes and I found few mods that think it is unsigned value
+						value.vali64 = std::stoull({line, pos+1});
+					}
+					break;
+				case AttributeValue::TYPE_STRING:
+				case AttributeValue::TYPE_TRANSLATE:
+					record.strValue.assign(line, pos+1, string::npos);
+					break;
 			}
-			else
+		}
+		catch (std::out_of_range&)
+		{
+			return record.setError(MalformedAttribute(lineNum, "attribute value is out of range"));
+		}
+		catch (std::invalid_argument&)
+		{
+			return record.setError(MalformedAttribute(lineNum, "invalid attribute value"));
+		}
+	}
+	else
+	{
+		// FIXME: for now silently ignore all lines starting with bogus data as it could be comment
+		//        I saw "//" used for comments in few mods and also commenting by prefixing section
+		//        name with things such as 'x' :   x[SECTION]
+	}
+}
+
+void DatFileLoader::_apply(ParseState& state, Record& record)
+{
+	Adm& adm = state.adm;
+	ErrorList* errors = state.errors;
+	auto& nodeStack = state.nodeStack;
+	size_t lineNum = record.lineNum;
+	
+	if (record.missingBracket)
+	{
+		if (errors != nullptr)
+			errors->push_back(std::make_shared<MissingClosingBracket>(lineNum));
+		else
+			*m_log << "WARNING at line " << lineNum << ": "
+			       << "missing closing ']' bracket at the end of section name."
+			       << std::endl;
+	}
+	
+	if (record.invalidUtf8Column != 0)
+	{
+		InvalidUtf8 warning(lineNum, record.invalidUtf8Column);
+		
+		if (errors != nullptr)
+			errors->push_back(std::make_shared<InvalidUtf8>(warning));
+		else
+			*m_log << warning.format() << std::endl;
+	}
+	
+	switch (record.kind)
+	{
+		case Record::NONE:
+			break;
+		case Record::ERROR:
+			// Only attribute lines can be malformed
+			if (nodeStack.empty())
 			{
-				// FIXME: treat missing ']' character as error?
-				
-				std::cerr << "WARNING at line " << lineNum << ": "
-				          << "missing closing ']' bracket at the end of section name."
-				          << std::endl;
-				sectionName = string(line, lineStart);
+				_fail(errors, RootLevelAttribute(lineNum));
+				break;
 			}
 			
-			// NOTE: for now ignoring anything following the ']' character and treating
-			//       that like comment
-			//       fix should come here
+			if (errors == nullptr)
+				std::rethrow_exception(record.errorToThrow);
 			
-			if (sectionClose)
+			errors->push_back(record.error);
+			break;
+		case Record::SECTION_CLOSE:
 			{
+				string const& sectionName = record.name;
+				
 				if (nodeStack.empty())
 				{
-					throw Exception(lineNum, string("section \"" + sectionName + "\" is being "
-						"closed, but no section is open"));
+					_fail(errors, Exception(lineNum, string("section \"" + sectionName + "\" is being "
+						"closed, but no section is open")));
+					break;
 				}
 				
-				string const& openSection = adm.getString(nodeStack.top()->name);
+				string const& openSection = adm.getString(nodeStack.back().node->name);
 				
 				if (sectionName != openSection)
 				{
 					if (!ignoreWrongNodeClosed())
-						throw WrongNodeClosed(lineNum, openSection, sectionName);
-					
-					std::cerr << "WARNING at line " << lineNum << ": section \""
-					          << sectionName << "\" is being closed but section \""
-					          << openSection << "\" is open." << std::endl;
+					{
+						_fail(errors, WrongNodeClosed(lineNum, openSection, sectionName));
+						
+						// Resync: close the named section if it is open further up
+						for (size_t i = nodeStack.size(); i-- > 1; )
+						{
+							if (adm.getString(nodeStack[i-1].node->name) == sectionName)
+							{
+								nodeStack.resize(i);
+								break;
+							}
+						}
+					}
+					else if (errors == nullptr)
+					{
+						*m_log << "WARNING at line " << lineNum << ": section \""
+						       << sectionName << "\" is being closed but section \""
+						       << openSection << "\" is open." << std::endl;
+					}
 				}
 				
-				nodeStack.pop();
+				nodeStack.pop_back();
 			}
-			else
+			break;
+		case Record::SECTION_OPEN:
 			{
 				Node *nodeptr;
 				
@@ -199,171 +649,81 @@ void DatFileLoader::load(Adm& adm)
 				
 				if (nodeStack.empty())
 				{
-					if (hasRoot)
-						throw MultipleRootSections(lineNum);
-					
-					hasRoot = true;
-					nodeptr = &adm.root();
+					if (state.hasRoot)
+					{
+						_fail(errors, MultipleRootSections(lineNum));
+						
+						state.extraRoot = Node();
+						nodeptr = &state.extraRoot;
+					}
+					else
+					{
+						state.hasRoot = true;
+						nodeptr = &adm.root();
+					}
 				}
 				else
 				{
-					NodeIterator it = nodeStack.top()->insertSubnode();
+					NodeIterator it = nodeStack.back().node->insertSubnode();
 					nodeptr = &*it;
 				}
 				
-				nodeptr->name = adm.addString(sectionName);
-				nodeStack.push(nodeptr);
+				nodeptr->name = adm.addString(std::move(record.name));
+				nodeStack.push_back({nodeptr, lineNum});
 			}
-		}
-		else if (line[lineStart] == '<')
-		{
-			string type_str, attr_name;
-			string::size_type pos;
-			AttributeValue value;
-			
+			break;
+		case Record::ATTRIBUTE:
 			if (nodeStack.empty())
-				throw RootLevelAttribute(lineNum);
-			
-			++lineStart;
-			
-			// Find '>' and get value type string
-			pos = line.find('>', lineStart);
-			
-			if (pos == string::npos)
-				throw MalformedAttribute(lineNum, "missing '>' character after attribute type");
-			
-			type_str = string(line, lineStart, pos - lineStart);
-			
-			if (type_str == "INTEGER")
-				value.type = AttributeValue::TYPE_INT;
-			else if (type_str == "FLOAT")
-				value.type = AttributeValue::TYPE_FLOAT;
-			else if (type_str == "DOUBLE")
-				value.type = AttributeValue::TYPE_DOUBLE;
-			else if (type_str == "UNSIGNED INT")
-				value.type = AttributeValue::TYPE_UINT;
-			else if (type_str == "STRING")
-				value.type = AttributeValue::TYPE_STRING;
-			else if (type_str == "BOOL")
-				value.type = AttributeValue::TYPE_BOOL;
-			else if (type_str == "INTEGER64")
-				value.type = AttributeValue::TYPE_INT64;
-			else if (type_str == "TRANSLATE")
-				value.type = AttributeValue::TYPE_TRANSLATE;
-			
-			if (value.type == AttributeValue::TYPE_INVALID)
-				InvalidAttributeType(lineNum, type_str);
-			
-			lineStart = pos + 1;
-			
-			pos = line.find(':', lineStart);
-			if (pos == string::npos)
-				throw MalformedAttribute(lineNum, "missing ':' character after attribute value");
-			
-			attr_name = string(line, lineStart, pos - lineStart);
-			
-			static_assert(
-				sizeof(long long) == sizeof(int64_t),
-				"Don't know string to int64_t conversion for this platform"
-			);
-			static_assert(
-				sizeof(int) == sizeof(int32_t),
-				"Don't know string to int32_t conversion for this platform"
-			);
-			
-			try
 			{
-				switch (value.type)
-				{
-					case AttributeValue::TYPE_INT:
-						value.vali32 = std::stoi({line, pos+1});
-						break;
-					case AttributeValue::TYPE_FLOAT:
-						value.valf = std::stof({line, pos+1});
-						break;
-					case AttributeValue::TYPE_DOUBLE:
-						value.vald = std::stod({line, pos+1});
-						break;
-					case AttributeValue::TYPE_UINT:
-						{
-							// No string -> unsigned conversion in C++,
-							// string -> unsigned long used instead and range-checked
-							unsigned long valul = std::stoul({line, pos+1});
-							if (valul > std::numeric_limits<unsigned>::max())
-								throw std::out_of_range("stou");
-							
-							value.valu32 = (uint32_t)valul;
-						}
-						break;
-					case AttributeValue::TYPE_BOOL:
-						{
-							string strval = utf8_to_upper({line, pos+1});
-							
-							if (strval.compare(0, 4, "TRUE") == 0)
-								value.valu32 = 1;
-							else if (strval.compare(0, 5, "FALSE") == 0)
-								value.valu32 = 0;
-							else
-								value.valu32 = (std::stoul({line, pos+1}) == 0UL ? 0 : 1);
-						}
-						break;
-					case AttributeValue::TYPE_INT64:
-						try {
-							value.vali64 = std::stoll({line, pos+1});
-						}
-						catch (std::out_of_range&)
-						{
-							// This may trigger undefined behavior on some platforms, but it should silently
-							// overflow on x86-64 linux system with GCC compiler. Unfortunately there is no
-							// TYPE_UINT64 for attributes and I found few mods that think it is unsigned value
-							value.vali64 = std::stoull({line, pos+1});
-						}
-						break;
-					case AttributeValue::TYPE_STRING:
-					case AttributeValue::TYPE_TRANSLATE:
-						value.valu32 = adm.addString({line, pos+1});
-						break;
-				}
-			}
-			catch (std::out_of_range&)
-			{
-				throw MalformedAttribute(lineNum, "attribute value is out of range");
-			}
-			catch (std::invalid_argument&)
-			{
-				throw MalformedAttribute(lineNum, "invalid attribute value");
+				_fail(errors, RootLevelAttribute(lineNum));
+				break;
 			}
 			
-			nodeStack.top()->insertAttribute(adm.addString(attr_name), value);
-		}
-		else
-		{
-			// FIXME: for now silently ignore all lines starting with bogus data as it could be comment
-			//        I saw "//" used for comments in few mods and also commenting by prefixing section
-			//        name with things such as 'x' :   x[SECTION]
-		}
+			if (record.value.type == AttributeValue::TYPE_STRING ||
+			    record.value.type == AttributeValue::TYPE_TRANSLATE)
+				record.value.valu32 = adm.addString(std::move(record.strValue));
+			
+			nodeStack.back().node->insertAttribute(adm.addString(std::move(record.name)), record.value);
+			break;
 	}
+}
+
+void DatFileLoader::_finish(ParseState& state, size_t lineNum)
+{
+	Adm& adm = state.adm;
+	auto& nodeStack = state.nodeStack;
 	
 	// Check if all sections were closed
 	if (!nodeStack.empty())
 	{
-		do
+		if (state.errors != nullptr)
 		{
-			Node* node = nodeStack.top();
-			nodeStack.pop();
-			
-			std::cerr << "ERROR at end of file: section \""
-			          << adm.getString(node->name) << "\" not closed."
-			          << std::endl;
+			for (ParseState::OpenSection const& section : nodeStack)
+			{
+				state.errors->push_back(std::make_shared<UnclosedSection>(
+					section.lineNum, adm.getString(section.node->name)));
+			}
+		}
+		else
+		{
+			do
+			{
+				Node* node = nodeStack.back().node;
+				nodeStack.pop_back();
+				
+				*m_log << "ERROR at end of file: section \""
+				       << adm.getString(node->name) << "\" not closed."
+				       << std::endl;
+				
+			} while (nodeStack.size() > 1);
 			
-		} while (nodeStack.size() > 1);
-		
-		throw std::runtime_error("Section not closed.");
+			throw std::runtime_error("Section not closed.");
+		}
 	}
 	
 	// Check if at least one root section was present
-	if (!hasRoot)
-		throw MissingRootSection(lineNum);
+	if (!state.hasRoot)
+		_fail(state.errors, MissingRootSection(lineNum));
 }
 
 
@@ -382,25 +742,44 @@ std::string DatFileLoader::Exception::format() const
 {
 	std::ostringstream strm;
 	
-	strm << "ERROR at line " << m_lineNumber << ": " << m_msg << ".";
+	strm << (isWarning() ? "WARNING" : "ERROR") << " at line " << m_lineNumber << ": " << describe();
 	return strm.str();
 }
 
-std::string DatFileLoader::WrongNodeClosed::format() const
+std::string DatFileLoader::Exception::describe() const
+{
+	return m_msg + ".";
+}
+
+std::string DatFileLoader::WrongNodeClosed::describe() const
 {
 	std::ostringstream strm;
 	
-	strm << "ERROR at line " << m_lineNumber << ": ";
 	strm << "node \"" << m_openNode << "\" is open, but node \"" << m_closedNode
 	     << "\" is being closed.";
 	return strm.str();
 }
 
-std::string DatFileLoader::InvalidAttributeType::format() const
+std::string DatFileLoader::UnclosedSection::describe() const
+{
+	std::ostringstream strm;
+	
+	strm << "section \"" << m_section << "\" is not closed.";
+	return strm.str();
+}
+
+std::string DatFileLoader::InvalidUtf8::describe() const
+{
+	std::ostringstream strm;
+	
+	strm << "invalid UTF-8 sequence at column " << m_column << ".";
+	return strm.str();
+}
+
+std::string DatFileLoader::InvalidAttributeType::describe() const
 {
 	std::ostringstream strm;
 	
-	strm << "ERROR at line " << m_lineNumber << ": ";
 	strm << "invalid attribute type \"" << m_attrType << "\".";
 	return strm.str();
 }
@@ -14,6 +14,8 @@
 #include "unicode_line_reader.h"
 
 #include <memory>
+#include <ostream>
+#include <vector>
 
 namespace tlmodder {
 namespace adm {
@@ -24,10 +26,24 @@ public:
 	DatFileLoader(std::string const& file);
 	DatFileLoader(DirIterator const& dir, std::string const& file);
 	
+	// Loads from already opened descriptor, such as standard input. Descriptor
+	// is not closed. Regular files are mapped, pipes and other streams are
+	// read in chunks.
+	explicit DatFileLoader(int fd);
+	
 	virtual ~DatFileLoader() {}
 	
+	class Exception;
+	using ExceptionPtr = std::shared_ptr<Exception>;
+	using ErrorList    = std::vector<ExceptionPtr>;
+	
 	void load(Adm& adm) override;
 	
+	// Loads the file like load(), but does not stop at first error. All errors
+	// and warnings are appended to 'errors' in order of line numbers. Returns
+	// false if any error (not warning) was found.
+	bool check(Adm& adm, ErrorList& errors);
+	
 	// NOTE: There are few mods out there that have wrong closing section name.
 	//       Torchlight's seems to ignore closing section names, but
 	//       there are also few mods that OPEN wrong section (such as Demonologist for skill level)
@@ -37,6 +53,22 @@ public:
 	
 	bool ignoreWrongNodeClosed() const
 	{ return _hasFlag(IgnoreWrongNodeClosed);  }
+	
+	// Mapped files of at least PARALLEL_MIN_SIZE bytes are split at line boundaries
+	// and tokenized by this many threads, 0 means number of CPUs. Default is 1
+	// (no threads). Result is the same as when loaded by single thread.
+	void threads(unsigned numThreads);
+	
+	unsigned threads() const
+	{ return m_threads; }
+	
+	// Warnings of load() and messages about sections left open are written
+	// here, default is std::cerr. check() reports them in its list instead.
+	void log(std::ostream& strm)
+	{ m_log = &strm; }
+	
+	static const size_t PARALLEL_MIN_SIZE  = 1024 * 1024;
+	static const size_t PARALLEL_MIN_CHUNK = 256 * 1024;
 public:
 	class Exception : public std::exception
 	{
@@ -54,7 +86,14 @@ public:
 		int lineNumber() const { return m_lineNumber; }
 		std::string const& message() const { return m_msg; }
 		
-		virtual std::string format() const;
+		// Short name of the error, used in reports
+		virtual char const* kind() const { return "error"; }
+		virtual bool isWarning() const { return false; }
+		
+		// Error description without line number
+		virtual std::string describe() const;
+		
+		std::string format() const;
 	};
 
 	class WrongNodeClosed : public Exception
@@ -72,7 +111,8 @@ public:
 		std::string const& openNode() const { return m_openNode; }
 		std::string const& closedNode() const { return m_closedNode; }
 		
-		std::string format() const override;
+		char const* kind() const override { return "wrong-node-closed"; }
+		std::string describe() const override;
 	};
 
 	class MultipleRootSections : public Exception
@@ -81,6 +121,8 @@ public:
 		MultipleRootSections(int lineNumber):
 			Exception(lineNumber, "second root section found")
 		{}
+		
+		char const* kind() const override { return "multiple-root-sections"; }
 	};
 
 	class RootLevelAttribute : public Exception
@@ -89,6 +131,8 @@ public:
 		RootLevelAttribute(int lineNumber):
 			Exception(lineNumber, "root-level attribute found")
 		{}
+		
+		char const* kind() const override { return "root-level-attribute"; }
 	};
 
 	class MissingRootSection : public Exception
@@ -97,6 +141,54 @@ public:
 		MissingRootSection(int lineNumber):
 			Exception(lineNumber, "no root section found")
 		{}
+		
+		char const* kind() const override { return "missing-root-section"; }
+	};
+
+	// Only reported by check(), load() throws std::runtime_error
+	class UnclosedSection : public Exception
+	{
+		std::string m_section;
+	public:
+		UnclosedSection(int lineNumber, std::string section):
+			Exception(lineNumber, "section not closed"),
+			m_section(std::move(section))
+		{}
+		
+		std::string const& section() const { return m_section; }
+		
+		char const* kind() const override { return "unclosed-section"; }
+		std::string describe() const override;
+	};
+
+	// Only reported by check(), load() prints warning
+	class MissingClosingBracket : public Exception
+	{
+	public:
+		MissingClosingBracket(int lineNumber):
+			Exception(lineNumber, "missing closing ']' bracket at the end of section name")
+		{}
+		
+		char const* kind() const override { return "missing-bracket"; }
+		bool isWarning() const override { return true; }
+	};
+
+	// Only reported by check(), load() prints warning
+	class InvalidUtf8 : public Exception
+	{
+		size_t m_column;
+	public:
+		InvalidUtf8(int lineNumber, size_t column):
+			Exception(lineNumber, "invalid UTF-8 sequence"),
+			m_column(column)
+		{}
+		
+		// Byte offset within the line, starting at 1
+		size_t column() const { return m_column; }
+		
+		char const* kind() const override { return "invalid-utf8"; }
+		bool isWarning() const override { return true; }
+		std::string describe() const override;
 	};
 
 	class MalformedAttribute : public Exception
@@ -105,6 +197,8 @@ public:
 		MalformedAttribute(int lineNumber, std::string msg):
 			Exception(lineNumber, std::move(msg))
 		{}
+		
+		char const* kind() const override { return "malformed-attribute"; }
 	};
 
 	class InvalidAttributeType : public MalformedAttribute
@@ -119,20 +213,57 @@ public:
 		std::string const& attributeType() const
 		{ return m_attrType; }
 		
-		std::string format() const override;
+		char const* kind() const override { return "invalid-attribute-type"; }
+		std::string describe() const override;
 	};
 protected:
+	struct Record;
+	struct ParseState;
+	
+	void _open(int fd, bool closeFd);
+	void _load(Adm& adm, ErrorList* errors);
+	
+	// Loaders are instantiated once per encoding, so that line reading and
+	// transcoding is inlined into the parsing loop
+	template<typename encoding_tag>
+	void _load(ParseState& state);
+	template<typename LineReader>
+	void _loadLines(ParseState& state, LineReader&& reader);
+	template<typename encoding_tag>
+	void _loadParallel(ParseState& state, unsigned numThreads);
+	
+	static void _tokenize(std::string const& line, size_t lineNum, Record& record);
+	void _apply(ParseState& state, Record& record);
+	void _finish(ParseState& state, size_t lineNum);
+	
+	template<typename LineReader>
+	static void _tokenizeChunk(LineReader&& reader, std::vector<Record>& records, size_t& numLines);
+	
+	template<typename unit_type>
+	static size_t _findLineBreak(unit_type const* data, size_t pos, size_t size, unit_type lf);
+	
+	template<typename ExceptionType>
+	static void _fail(ErrorList* errors, ExceptionType&& e);
+	
 	void _detectEncoding();
 	bool _hasFlag(uint32_t flag) const { return (m_flags & flag) == flag; }
 protected:
 	enum : uint32_t {
 		IgnoreWrongNodeClosed = 1u << 0,
 	};
-	using LineReaderPtr = std::shared_ptr<unicode_line_reader>;
+	using MappedFilePtr   = std::unique_ptr<MappedFile>;
+	using StreamBufferPtr = std::unique_ptr<stream_buffer>;
 	
-	MappedFile m_file;
+	MappedFilePtr m_file;   // null when reading from stream
 	uint32_t m_flags;
-	LineReaderPtr m_lineReader;
+	unsigned m_threads;
+	std::ostream* m_log;
+	StreamBufferPtr m_stream; // null when reading mapped file
+	
+	// Mapped file content without BOM
+	UnicodeEncoding m_encoding;  // set for streams too
+	uint8_t const* m_data;
+	size_t m_size;
 };
 
 }
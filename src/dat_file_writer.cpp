@@ -0,0 +1,346 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "dat_file_writer.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stack>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tlmodder {
+namespace adm {
+
+using std::string;
+
+// Formats DAT lines into large buffer which is handed to _write() only when full,
+// instead of formatting (and flushing) each line through std::ostream
+class DatEmitter
+{
+public:
+	static const size_t BUFFER_SIZE = 256 * 1024;
+	
+	DatEmitter(UnicodeEncoding encoding);
+	virtual ~DatEmitter() {}
+	
+	void emit(Adm const& adm);
+protected:
+	virtual void _write(char const* data, size_t size) = 0;
+	
+	void _flush();
+	void _endLine();
+	void _emitAttributes(Adm const& adm, Node const& node);
+	
+	void _put(char c)
+	{ m_buf += c; }
+	
+	void _put(char const* str, size_t len)
+	{ m_buf.append(str, len); }
+	
+	template<size_t N>
+	void _put(char const (&str)[N])
+	{ m_buf.append(str, N - 1); }
+	
+	void _put(string const& str)
+	{ m_buf.append(str); }
+	
+	void _putUInt(uint64_t value);
+	void _putInt(int64_t value);
+	void _putFloat(float value);
+	void _putDouble(double value);
+protected:
+	UnicodeEncoding m_encoding;
+	string m_buf;                     // always UTF-8, whole lines only
+	std::vector<char16_t> m_utf16buf;
+};
+
+DatEmitter::DatEmitter(UnicodeEncoding encoding):
+	m_encoding(encoding)
+{
+	if (encoding != UnicodeEncoding::UTF_8 && encoding != UnicodeEncoding::UTF_16LE)
+		throw std::runtime_error("Unsupported DAT file encoding");
+	
+	m_buf.reserve(BUFFER_SIZE + 4096);
+}
+
+void DatEmitter::_flush()
+{
+	if (m_buf.empty())
+		return;
+	
+	if (m_encoding == UnicodeEncoding::UTF_8)
+	{
+		_write(m_buf.data(), m_buf.size());
+	}
+	else
+	{
+		size_t len;
+		
+		// Buffer contains whole lines, so no character is split
+		m_utf16buf.resize(m_buf.size());
+		len = utf8_to_utf16(m_buf.data(), m_buf.size(), m_utf16buf.data());
+		
+		for (size_t i = 0; i < len; ++i)
+			m_utf16buf[i] = utf16_endian_conv<utf16_le_t>::conv(m_utf16buf[i]);
+		
+		_write((char const*)m_utf16buf.data(), len * sizeof(char16_t));
+	}
+	
+	m_buf.clear();
+}
+
+void DatEmitter::_endLine()
+{
+	if (m_encoding == UnicodeEncoding::UTF_8)
+		_put('\n');
+	else
+		_put("\r\n");
+	
+	if (m_buf.size() >= BUFFER_SIZE)
+		_flush();
+}
+
+void DatEmitter::_putUInt(uint64_t value)
+{
+	char buf[20];
+	char* ptr = buf + sizeof(buf);
+	
+	do
+	{
+		*--ptr = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+	
+	_put(ptr, buf + sizeof(buf) - ptr);
+}
+
+void DatEmitter::_putInt(int64_t value)
+{
+	if (value < 0)
+	{
+		_put('-');
+		_putUInt(0 - (uint64_t)value);
+	}
+	else
+	{
+		_putUInt((uint64_t)value);
+	}
+}
+
+// Shortest representation which reads back as the same value. Since adding digits
+// never breaks round trip, binary search over %g precision is used.
+void DatEmitter::_putFloat(float value)
+{
+	char buf[32];
+	int low = 1, high = 9, len = 0, precision;
+	
+	while (low < high)
+	{
+		precision = (low + high) / 2;
+		std::snprintf(buf, sizeof(buf), "%.*g", precision, (double)value);
+		
+		if (std::strtof(buf, nullptr) == value)
+			high = precision;
+		else
+			low = precision + 1;
+	}
+	
+	len = std::snprintf(buf, sizeof(buf), "%.*g", low, (double)value);
+	_put(buf, (size_t)len);
+}
+
+void DatEmitter::_putDouble(double value)
+{
+	char buf[40];
+	int low = 1, high = 17, len = 0, precision;
+	
+	while (low < high)
+	{
+		precision = (low + high) / 2;
+		std::snprintf(buf, sizeof(buf), "%.*g", precision, value);
+		
+		if (std::strtod(buf, nullptr) == value)
+			high = precision;
+		else
+			low = precision + 1;
+	}
+	
+	len = std::snprintf(buf, sizeof(buf), "%.*g", low, value);
+	_put(buf, (size_t)len);
+}
+
+void DatEmitter::_emitAttributes(Adm const& adm, Node const& node)
+{
+	for (auto& attribute : node.attributes)
+	{
+		std::string const& name = adm.getString(attribute.first);
+		
+		switch (attribute.second.type)
+		{
+			case AttributeValue::TYPE_INT:
+				_put("<INTEGER>"); _put(name); _put(':');
+				_putInt(attribute.second.vali32);
+				break;
+			case AttributeValue::TYPE_FLOAT:
+				_put("<FLOAT>"); _put(name); _put(':');
+				_putFloat(attribute.second.valf);
+				break;
+			case AttributeValue::TYPE_DOUBLE:
+				_put("<DOUBLE>"); _put(name); _put(':');
+				_putDouble(attribute.second.vald);
+				break;
+			case AttributeValue::TYPE_UINT:
+				_put("<UNSIGNED INT>"); _put(name); _put(':');
+				_putUInt(attribute.second.valu32);
+				break;
+			case AttributeValue::TYPE_STRING:
+				_put("<STRING>"); _put(name); _put(':');
+				_put(adm.getString(attribute.second.valu32));
+				break;
+			case AttributeValue::TYPE_BOOL:
+				_put("<BOOL>"); _put(name); _put(':');
+				if (attribute.second.valu32 != 0)
+					_put("true");
+				else
+					_put("false");
+				break;
+			case AttributeValue::TYPE_INT64:
+				_put("<INTEGER64>"); _put(name); _put(':');
+				_putInt(attribute.second.vali64);
+				break;
+			case AttributeValue::TYPE_TRANSLATE:
+				_put("<TRANSLATE>"); _put(name); _put(':');
+				_put(adm.getString(attribute.second.valu32));
+				break;
+		}
+		
+		_endLine();
+	}
+}
+
+void DatEmitter::emit(Adm const& adm)
+{
+	using SourcePair = std::pair<Node const*, NodeConstIterator>;
+	using SourceStack = std::stack<SourcePair>;
+	
+	SourceStack sourceStack;
+	sourceStack.push(std::make_pair(&adm.root(), adm.root().subnodes.begin()));
+	
+	if (m_encoding == UnicodeEncoding::UTF_16LE)
+		_write("\xff\xfe", 2);
+	
+	while (!sourceStack.empty())
+	{
+		SourcePair& source = sourceStack.top();
+		Node const& node = *source.first;
+		
+		if (source.second == node.subnodes.begin())
+		{
+			_put('['); _put(adm.getString(node.name)); _put(']');
+			_endLine();
+			_emitAttributes(adm, node);
+		}
+		
+		if (source.second != node.subnodes.end())
+		{
+			Node const& childNode = *source.second;
+			sourceStack.push(std::make_pair(&childNode, childNode.subnodes.begin()));
+			++source.second;
+		}
+		else
+		{
+			_put("[/"); _put(adm.getString(node.name)); _put(']');
+			_endLine();
+			sourceStack.pop();
+		}
+	}
+	
+	_flush();
+}
+
+
+class StreamDatEmitter : public DatEmitter
+{
+public:
+	StreamDatEmitter(std::ostream& strm, UnicodeEncoding encoding):
+		DatEmitter(encoding),
+		m_strm(strm)
+	{}
+protected:
+	void _write(char const* data, size_t size) override
+	{ m_strm.write(data, size); }
+	
+	std::ostream& m_strm;
+};
+
+class FdDatEmitter : public DatEmitter
+{
+public:
+	FdDatEmitter(int fd, UnicodeEncoding encoding):
+		DatEmitter(encoding),
+		m_fd(fd)
+	{}
+protected:
+	void _write(char const* data, size_t size) override
+	{
+		ssize_t written;
+		
+		while (size != 0)
+		{
+			written = ::write(m_fd, data, size);
+			
+			if (written == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				throw std::runtime_error("write() failed");
+			}
+			
+			data += written;
+			size -= (size_t)written;
+		}
+	}
+	
+	int m_fd;
+};
+
+
+void datFileWrite(std::ostream& strm, Adm const& adm, UnicodeEncoding encoding)
+{
+	StreamDatEmitter emitter(strm, encoding);
+	emitter.emit(adm);
+}
+
+void datFileWrite(std::string const& filename, Adm const& adm, UnicodeEncoding encoding)
+{
+	int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	
+	if (fd == -1)
+		throw std::runtime_error("cannot open " + filename);
+	
+	try {
+		FdDatEmitter emitter(fd, encoding);
+		emitter.emit(adm);
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
+	
+	if (::close(fd) != 0)
+		throw std::runtime_error("cannot write " + filename);
+}
+
+} // namespace adm
+} // namespace tlmodder
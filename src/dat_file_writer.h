@@ -0,0 +1,29 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __DAT_FILE_WRITER_H__
+#define __DAT_FILE_WRITER_H__
+
+#include "adm.h"
+#include "unicode.h"
+#include <iostream>
+
+namespace tlmodder {
+namespace adm {
+
+// Writes Adm as textual DAT file. Supported encodings are UTF_8 (no BOM, LF line
+// endings) and UTF_16LE (with BOM and CR+LF line endings, like files shipped with
+// the game). Floating point values are written with as few digits as needed to
+// read back the same value.
+void datFileWrite(std::ostream& strm, Adm const& adm, UnicodeEncoding encoding = UnicodeEncoding::UTF_8);
+void datFileWrite(std::string const& filename, Adm const& adm, UnicodeEncoding encoding = UnicodeEncoding::UTF_8);
+
+}
+}
+
+#endif
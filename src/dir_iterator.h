@@ -11,10 +11,14 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <errno.h>
 
+#include <cstdint>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -22,6 +26,11 @@ namespace tlmodder {
 
 using std::string;
 
+// Iterates over directory entries
+// Entries are read in large getdents64() batches together with their type,
+// so callers don't need to stat each entry just to tell files from
+// directories. Only if the file system doesn't report types, the entry is
+// stat'ed with minimal mask.
 class DirIterator
 {
 public:
@@ -33,18 +42,31 @@ public:
 		{}
 	};
 	
-	DirIterator(): m_dir(nullptr) {}
+	enum EntryType
+	{
+		TYPE_FILE,      // regular file
+		TYPE_DIR,
+		TYPE_OTHER      // symbolic link, device, ..., or entry which cannot be stat'ed
+	};
+	
+	static const size_t BUFFER_SIZE = 64 * 1024;
 	
-	DirIterator(string const& path) : m_dir(nullptr)
+	DirIterator(): m_fd(-1), m_pos(0), m_end(0) {}
+	
+	DirIterator(string const& path) : m_fd(-1), m_pos(0), m_end(0)
 	{ open(path); }
 	
-	DirIterator(DirIterator const& dir, string const& path) : m_dir(nullptr)
+	DirIterator(DirIterator const& dir, string const& path) : m_fd(-1), m_pos(0), m_end(0)
 	{ open(dir, path); }
 	
-	DirIterator(DirIterator&& other) noexcept
+	DirIterator(DirIterator&& other) noexcept:
+		m_fd(other.m_fd),
+		m_buf(std::move(other.m_buf)),
+		m_pos(other.m_pos),
+		m_end(other.m_end)
 	{
-		m_dir = other.m_dir;
-		other.m_dir = nullptr;
+		other.m_fd = -1;
+		other.m_pos = other.m_end = 0;
 	}
 	
 	DirIterator(DirIterator const&) = delete;
@@ -53,33 +75,33 @@ public:
 	DirIterator& operator=(DirIterator&& other)
 	{
 		close();
-		m_dir = other.m_dir;
-		other.m_dir = nullptr;
+		m_fd = other.m_fd;
+		m_buf = std::move(other.m_buf);
+		m_pos = other.m_pos;
+		m_end = other.m_end;
+		other.m_fd = -1;
+		other.m_pos = other.m_end = 0;
 		return *this;
 	}
 	
 	~DirIterator() noexcept
 	{
-		if (m_dir != nullptr)
-			::closedir(m_dir);
+		if (m_fd != -1)
+			::close(m_fd);
 	}
 	
 	bool open(std::nothrow_t, string const& path) noexcept
 	{
 		close();
-		m_dir = ::opendir(path.c_str());
-		return (m_dir != nullptr);
+		m_fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		return (m_fd != -1);
 	}
 	
 	bool open(std::nothrow_t, DirIterator const& dir, string const& path) noexcept
 	{
 		close();
-		int fd = dir.open(path.c_str(), O_RDONLY | O_DIRECTORY);
-		if (fd == -1)
-			return false;
-		
-		m_dir = fdopendir(fd);
-		return (m_dir != nullptr);
+		m_fd = dir.open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		return (m_fd != -1);
 	}
 	
 	void open(string const& path)
@@ -96,26 +118,43 @@ public:
 	
 	void close() noexcept
 	{
-		if (m_dir != nullptr) {
-			::closedir(m_dir);
-			m_dir = nullptr;
+		if (m_fd != -1) {
+			::close(m_fd);
+			m_fd = -1;
 		}
+		m_pos = m_end = 0;
 	}
 	
 	bool next(string& fn)
 	{
-		struct dirent *e;
+		unsigned char type;
+		return _next(fn, type);
+	}
+	
+	bool next(string& fn, EntryType& type)
+	{
+		unsigned char dtype;
 		
-		while ((e = ::readdir(m_dir)) != nullptr)
+		if (!_next(fn, dtype))
+			return false;
+		
+		switch (dtype)
 		{
-			if (!isDots(e->d_name))
-			{
-				fn = e->d_name;
-				return true;
-			}
+			case DT_REG:
+				type = TYPE_FILE;
+				break;
+			case DT_DIR:
+				type = TYPE_DIR;
+				break;
+			case DT_UNKNOWN:
+				type = statType(fn.c_str());
+				break;
+			default:
+				type = TYPE_OTHER;
+				break;
 		}
 		
-		return false;
+		return true;
 	}
 	
 	static inline bool isDots(char const* fn) noexcept
@@ -124,19 +163,94 @@ public:
 	}
 	
 	inline int open(char const* fn, int flags) const noexcept
-	{ return ::openat(::dirfd(m_dir), fn, flags); }
+	{ return ::openat(m_fd, fn, flags); }
 	
 	inline int open(string const& fn, int flags) const noexcept
 	{ return open(fn.c_str(), flags); }
 	
 	inline bool stat(char const* fn, struct stat& st, bool followSymlinks = true) const noexcept
-	{ return ::fstatat(::dirfd(m_dir), fn, &st, followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0; }
+	{ return ::fstatat(m_fd, fn, &st, followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW) == 0; }
 	
 	inline bool stat(string const& fn, struct stat& st, bool followSymlinks = true) const noexcept
 	{ return stat(fn.c_str(), st, followSymlinks); }
 	
+	// Type of entry, symbolic links are not followed
+	EntryType statType(char const* fn) const noexcept
+	{
+		struct stat st;
+		
+#ifdef STATX_TYPE
+		struct statx stx;
+		
+		if (::statx(m_fd, fn, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stx) == 0)
+			return modeType(stx.stx_mode);
+		
+		// Kernel without statx
+		if (errno != ENOSYS)
+			return TYPE_OTHER;
+#endif
+		
+		if (!stat(fn, st, false))
+			return TYPE_OTHER;
+		
+		return modeType(st.st_mode);
+	}
+	
+	static EntryType modeType(mode_t mode) noexcept
+	{
+		if (S_ISREG(mode))
+			return TYPE_FILE;
+		else if (S_ISDIR(mode))
+			return TYPE_DIR;
+		return TYPE_OTHER;
+	}
+	
+protected:
+	// Layout of entries returned by getdents64
+	struct LinuxDirent64
+	{
+		uint64_t       d_ino;
+		int64_t        d_off;
+		unsigned short d_reclen;
+		unsigned char  d_type;
+		char           d_name[1];
+	};
+	
+	bool _next(string& fn, unsigned char& type)
+	{
+		for (;;)
+		{
+			while (m_pos < m_end)
+			{
+				LinuxDirent64 const* e = (LinuxDirent64 const*)(m_buf.get() + m_pos);
+				m_pos += e->d_reclen;
+				
+				if (!isDots(e->d_name))
+				{
+					fn = e->d_name;
+					type = e->d_type;
+					return true;
+				}
+			}
+			
+			if (!m_buf)
+				m_buf.reset(new char[BUFFER_SIZE]);
+			
+			long size = ::syscall(SYS_getdents64, m_fd, m_buf.get(), BUFFER_SIZE);
+			
+			if (size <= 0)
+				return false;
+			
+			m_pos = 0;
+			m_end = (size_t)size;
+		}
+	}
+	
 protected:
-	DIR *m_dir;
+	int m_fd;
+	std::unique_ptr<char[]> m_buf;
+	size_t m_pos;      // next entry in m_buf
+	size_t m_end;      // end of entries in m_buf
 };
 
 
@@ -0,0 +1,290 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "file_copy.h"
+#include "mapped_file.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace tlmodder {
+
+namespace {
+
+// Largest amount requested from the kernel at once, it copies less anyway
+const size_t KERNEL_CHUNK = 1u << 30;
+const size_t BUFFER_SIZE = 1024 * 1024;
+
+enum CopyResult
+{
+	COPY_DONE,
+	COPY_UNSUPPORTED,     // nothing was copied by this call, try another method
+	COPY_FAILED
+};
+
+// Errors meaning that the method cannot be used for these files
+bool isUnsupported(int error)
+{
+	return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP ||
+	       error == ENOTTY || error == EPERM || error == EBADF;
+}
+
+template<typename CopyFunc>
+CopyResult copyInKernel(CopyFunc copy, bool expectData)
+{
+	bool copiedAny = false;
+	ssize_t len;
+	
+	for (;;)
+	{
+		len = copy();
+		
+		if (len > 0)
+		{
+			copiedAny = true;
+			continue;
+		}
+		
+		if (len == 0)
+		{
+			// Some filesystems report end of file instead of not supporting it
+			if (!copiedAny && expectData)
+				return COPY_UNSUPPORTED;
+			return COPY_DONE;
+		}
+		
+		if (errno == EINTR)
+			continue;
+		
+		if (!copiedAny && isUnsupported(errno))
+			return COPY_UNSUPPORTED;
+		
+		return COPY_FAILED;
+	}
+}
+
+bool copyInUserspace(int srcFd, int dstFd)
+{
+	std::unique_ptr<char[]> buf(new char[BUFFER_SIZE]);
+	ssize_t len, written;
+	
+	for (;;)
+	{
+		len = ::read(srcFd, buf.get(), BUFFER_SIZE);
+		
+		if (len == -1 && errno == EINTR)
+			continue;
+		
+		if (len <= 0)
+			return len == 0;
+		
+		for (ssize_t pos = 0; pos < len; pos += written)
+		{
+			written = ::write(dstFd, buf.get() + pos, len - pos);
+			
+			if (written == -1 && errno == EINTR)
+				written = 0;
+			else if (written <= 0)
+				return false;
+		}
+	}
+}
+
+// Hard and symbolic links cannot be created in place of existing file
+template<typename CreateFunc>
+bool replaceFile(string const& dst, CreateFunc create)
+{
+	if (create())
+		return true;
+	
+	if (errno != EEXIST || (::unlink(dst.c_str()) != 0 && errno != ENOENT))
+		return false;
+	
+	return create();
+}
+
+bool createFile(string const& path, int& fd)
+{
+	return replaceFile(path, [&]() { return (fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)) != -1; });
+}
+
+// Output file which can be kept, link to other file can't
+bool isSeparateFile(string const& path, struct stat& st)
+{
+	return ::lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1;
+}
+
+bool sameContents(MappedFile const& file, char const* data, size_t size)
+{
+	return file.size() == size && std::memcmp(file.ptr(), data, size) == 0;
+}
+
+bool copyData(int srcFd, int dstFd, bool expectData)
+{
+	CopyResult result;
+	
+	if (::ioctl(dstFd, FICLONE, srcFd) == 0)
+		return true;
+	
+	result = copyInKernel([=]() { return ::copy_file_range(srcFd, nullptr, dstFd, nullptr, KERNEL_CHUNK, 0); }, expectData);
+	if (result != COPY_UNSUPPORTED)
+		return result == COPY_DONE;
+	
+	result = copyInKernel([=]() { return ::sendfile(dstFd, srcFd, nullptr, KERNEL_CHUNK); }, expectData);
+	if (result != COPY_UNSUPPORTED)
+		return result == COPY_DONE;
+	
+	return copyInUserspace(srcFd, dstFd);
+}
+
+}
+
+void copyFileData(string const& src, string const& dst, bool preserveAttributes)
+{
+	struct stat st;
+	int srcFd, dstFd;
+	bool ok;
+	
+	if ((srcFd = ::open(src.c_str(), O_RDONLY | O_CLOEXEC)) == -1)
+		throw std::runtime_error(string("cannot open source file: ") + std::strerror(errno));
+	
+	dstFd = -1;
+	
+	if (::fstat(srcFd, &st) != 0 || !createFile(dst, dstFd))
+	{
+		int error = errno;
+		::close(srcFd);
+		throw std::runtime_error(string("cannot create file: ") + std::strerror(error));
+	}
+	
+	ok = copyData(srcFd, dstFd, st.st_size > 0) && (!preserveAttributes || copyFileAttributes(srcFd, dstFd));
+	int error = errno;
+	
+	::close(srcFd);
+	
+	if (::close(dstFd) != 0 && ok)
+	{
+		ok = false;
+		error = errno;
+	}
+	
+	if (!ok)
+		throw std::runtime_error(string("cannot copy file: ") + std::strerror(error));
+}
+
+void writeFileData(string const& path, char const* data, size_t size)
+{
+	ssize_t written;
+	int fd, error;
+	
+	if (!createFile(path, fd))
+		throw std::runtime_error(string("cannot create file: ") + std::strerror(errno));
+	
+	for (size_t pos = 0; pos < size; pos += (size_t)written)
+	{
+		written = ::write(fd, data + pos, size - pos);
+		
+		if (written == -1 && errno == EINTR)
+		{
+			written = 0;
+		}
+		else if (written <= 0)
+		{
+			error = (written == 0) ? ENOSPC : errno;
+			::close(fd);
+			throw std::runtime_error(string("cannot write file: ") + std::strerror(error));
+		}
+	}
+	
+	if (::close(fd) != 0)
+		throw std::runtime_error(string("cannot write file: ") + std::strerror(errno));
+}
+
+bool fileHasContents(string const& path, char const* data, size_t size)
+{
+	struct stat st;
+	
+	if (!isSeparateFile(path, st) || (uint64_t)st.st_size != size)
+		return false;
+	
+	try {
+		return sameContents(MappedFile(path), data, size);
+	}
+	catch (MappedFile::MappingFailed&)
+	{
+		return false;
+	}
+}
+
+bool isCopyOf(string const& src, string const& dst, bool sameAttributes)
+{
+	struct stat srcSt, dstSt;
+	
+	if (!isSeparateFile(dst, dstSt) || ::stat(src.c_str(), &srcSt) != 0 || srcSt.st_size != dstSt.st_size)
+		return false;
+	
+	if (sameAttributes && ((srcSt.st_mode & 07777) != (dstSt.st_mode & 07777) ||
+	                       srcSt.st_mtim.tv_sec != dstSt.st_mtim.tv_sec ||
+	                       srcSt.st_mtim.tv_nsec != dstSt.st_mtim.tv_nsec))
+		return false;
+	
+	try {
+		MappedFile srcFile(src);
+		return sameContents(MappedFile(dst), (char const*)srcFile.ptr(), srcFile.size());
+	}
+	catch (MappedFile::MappingFailed&)
+	{
+		return false;
+	}
+}
+
+bool isLinkTo(string const& src, string const& dst)
+{
+	struct stat srcSt, dstSt;
+	
+	return ::stat(dst.c_str(), &dstSt) == 0 && ::stat(src.c_str(), &srcSt) == 0 &&
+	       srcSt.st_dev == dstSt.st_dev && srcSt.st_ino == dstSt.st_ino;
+}
+
+bool linkFile(string const& src, string const& dst)
+{
+	if (replaceFile(dst, [&]() { return ::link(src.c_str(), dst.c_str()) == 0; }))
+		return true;
+	
+	if (errno != EXDEV && errno != EPERM && errno != EMLINK)
+		return false;
+	
+	// Existing dst is reported before other errors, so dst doesn't exist here
+	return ::symlink(src.c_str(), dst.c_str()) == 0;
+}
+
+bool copyFileAttributes(int srcFd, int dstFd)
+{
+	struct stat st;
+	struct timespec times[2];
+	
+	if (::fstat(srcFd, &st) != 0)
+		return false;
+	
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	
+	return ::fchmod(dstFd, st.st_mode & 07777) == 0 && ::futimens(dstFd, times) == 0;
+}
+
+}
@@ -0,0 +1,60 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_FILE_COPY_H__
+#define __TLMODDER_FILE_COPY_H__
+
+#include <cstddef>
+#include <string>
+
+namespace tlmodder {
+
+using std::string;
+
+// Copies regular file src into dst, which is created or replaced
+// Existing dst is removed rather than truncated, because it may be a link to
+// a source file made by linkFile().
+// Tries reflink (FICLONE) first, which only shares data blocks on copy-on-write
+// filesystems, then copy_file_range() and sendfile(), which copy inside the
+// kernel, and read()/write() with large buffer as the last resort. Each
+// method continues where the previous one stopped.
+// Throws std::runtime_error on failure.
+void copyFileData(string const& src, string const& dst, bool preserveAttributes);
+
+// Puts src into dst as hard link, or as symbolic link if hard link is not
+// possible, for example because they are on different filesystems. src must
+// be an absolute path. Existing dst is replaced.
+// Returns false if neither link can be created, errno is set then.
+bool linkFile(string const& src, string const& dst);
+
+// Writes data into file at path, which is created or replaced the same way as
+// by copyFileData(). Throws std::runtime_error on failure.
+void writeFileData(string const& path, char const* data, size_t size);
+
+// Following functions tell whether output file is already what would be
+// written, they return false if it doesn't exist
+
+// File at path is a separate regular file containing exactly data
+bool fileHasContents(string const& path, char const* data, size_t size);
+
+// dst is a separate regular file with the same contents as src
+// Links to src don't count, copying replaces them. With sameAttributes, dst
+// must also have permission bits and modification time of src, as given by
+// copyFileAttributes().
+bool isCopyOf(string const& src, string const& dst, bool sameAttributes);
+
+// dst is src itself, through hard or symbolic link
+bool isLinkTo(string const& src, string const& dst);
+
+// Gives dst permission bits and access and modification times of src
+// Returns false on failure, errno is set then.
+bool copyFileAttributes(int srcFd, int dstFd);
+
+}
+
+#endif
@@ -8,6 +8,8 @@
 
 #include "filename_utils.h"
 #include <fstream>
+#include <cstring>
+#include <algorithm>
 
 namespace tlmodder
 {
@@ -22,6 +24,19 @@ string FileName::extension(string const& fn)
 	return {fn, dot_pos+1};
 }
 
+StringRef FileName::extensionRef(StringRef fn)
+{
+	char const* dot = fn.end();
+	
+	while (dot != fn.begin() && *(dot-1) != '.')
+		--dot;
+	
+	if (dot == fn.begin() || dot - 1 == fn.begin())
+		return {};
+	
+	return StringRef(dot, fn.end() - dot);
+}
+
 string FileName::stripExt(string const& fn)
 {
 	string::size_type dot_pos = fn.rfind('.');
@@ -100,9 +115,9 @@ void FileName::parentInplace(string& path)
 		path.resize(slash);
 }
 
-bool FileName::isParentOf(string const& parent, string const& child)
+bool FileName::isParentOf(StringRef parent, StringRef child)
 {
-	string::size_type check_size, parent_size, child_size;
+	size_t check_size, parent_size, child_size;
 	
 	check_size = parent_size = parent.size();
 	child_size = child.size();
@@ -116,11 +131,8 @@ bool FileName::isParentOf(string const& parent, string const& child)
 	if (child_size < check_size)
 		return false;
 	
-	for (string::size_type i = 0; i < check_size; ++i)
-	{
-		if (child[i] != parent[i])
-			return false;
-	}
+	if (std::memcmp(child.data(), parent.data(), check_size) != 0)
+		return false;
 	
 	if (child_size > check_size && child[check_size] != '/')
 		return false;
@@ -163,7 +175,73 @@ string FileName::build(std::initializer_list<string const> parts)
 }
 
 
+// ~~ PathBuilder ~~
 
+PathBuilder::~PathBuilder()
+{
+	if (m_data != m_inline)
+		delete[] m_data;
+}
+
+void PathBuilder::_reserve(size_t size)
+{
+	char* data;
+	
+	if (size <= m_capacity)
+		return;
+	
+	size = std::max(size, m_capacity * 2);
+	data = new char[size + 1];
+	std::memcpy(data, m_data, m_size + 1);
+	
+	if (m_data != m_inline)
+		delete[] m_data;
+	
+	m_data = data;
+	m_capacity = size;
+}
 
+void PathBuilder::assign(StringRef path)
+{
+	_reserve(path.size());
+	std::memmove(m_data, path.data(), path.size());
+	pop(path.size());
+}
+
+size_t PathBuilder::push(StringRef name)
+{
+	size_t prevSize = m_size;
+	
+	if (m_size != 0 && m_data[m_size-1] != '/')
+	{
+		_reserve(m_size + 1 + name.size());
+		m_data[m_size++] = '/';
+	}
+	
+	append(name);
+	return prevSize;
+}
+
+void PathBuilder::append(StringRef str)
+{
+	_reserve(m_size + str.size());
+	std::memcpy(m_data + m_size, str.data(), str.size());
+	pop(m_size + str.size());
+}
+
+void PathBuilder::up()
+{
+	char const* slash = m_data + m_size;
+	
+	while (slash != m_data && *(slash-1) != '/')
+		--slash;
+	
+	if (slash == m_data)
+		pop(0);
+	else if (slash - 1 == m_data)
+		pop(1); // Keep '/' if absolute
+	else
+		pop(slash - 1 - m_data);
+}
 
 }
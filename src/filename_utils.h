@@ -9,6 +9,8 @@
 #ifndef __FILENAME_UTILS_H__
 #define __FILENAME_UTILS_H__
 
+#include "string_ref.h"
+
 #include <string>
 #include <iostream>
 #include <initializer_list>
@@ -22,6 +24,7 @@ class FileName
 {
 public:
 	static string extension(string const& fn);
+	static StringRef extensionRef(StringRef fn);
 	static string stripExt(string const& fn);
 	static void   stripExtInplace(string& fn);
 	static string baseName(string const& fn);
@@ -29,7 +32,7 @@ public:
 	static void   buildInplace(string& path, string const& basename);
 	static string parent(string const& path);
 	static void   parentInplace(string& path);
-	static bool   isParentOf(string const& parent, string const& child);
+	static bool   isParentOf(StringRef parent, StringRef child);
 	static string build(std::initializer_list<string const> parts);
 	
 	static void winSlashesToPosix(string& fn);
@@ -74,10 +77,10 @@ public:
 	inline string build(string const& fn) const
 	{ return build(m_fn, fn); }
 	
-	inline bool isParentOf(string const& child) const
+	inline bool isParentOf(StringRef child) const
 	{ return isParentOf(m_fn, child); }
 	
-	inline bool isChildOf(string const& parent) const
+	inline bool isChildOf(StringRef parent) const
 	{ return isParentOf(parent, m_fn); }
 	
 	inline bool isParentOf(FileName const& child) const
@@ -94,6 +97,96 @@ protected:
 	string m_fn;
 };
 
+
+// Path which is modified in place while walking directory trees
+// Components are appended and removed without allocating as long as the path
+// fits into the inline buffer. Path is always NUL-terminated, so it can be
+// passed to system calls directly.
+class PathBuilder
+{
+public:
+	static const size_t INLINE_SIZE = 256;
+	
+	PathBuilder():
+		m_data(m_inline), m_size(0), m_capacity(INLINE_SIZE)
+	{ m_inline[0] = '\0'; }
+	
+	explicit PathBuilder(StringRef path):
+		PathBuilder()
+	{ assign(path); }
+	
+	PathBuilder(PathBuilder const& other):
+		PathBuilder()
+	{ assign(other.view()); }
+	
+	~PathBuilder();
+	
+	PathBuilder& operator=(PathBuilder const& other)
+	{
+		if (this != &other)
+			assign(other.view());
+		return *this;
+	}
+	
+	void assign(StringRef path);
+	
+	void clear()
+	{ pop(0); }
+	
+	// Appends '/' and name, same as FileName::cd()
+	// Returns previous length of the path, which can be passed to pop()
+	size_t push(StringRef name);
+	
+	// Appends string without separator, e.g. extension
+	void append(StringRef str);
+	
+	// Truncates path to length returned by push()
+	void pop(size_t size)
+	{
+		m_size = size;
+		m_data[m_size] = '\0';
+	}
+	
+	void cd(StringRef name)
+	{ push(name); }
+	
+	// Removes last component, same as FileName::up()
+	void up();
+	
+	StringRef view() const
+	{ return StringRef(m_data, m_size); }
+	
+	operator StringRef() const
+	{ return view(); }
+	
+	char const* c_str() const
+	{ return m_data; }
+	
+	size_t size() const
+	{ return m_size; }
+	
+	bool empty() const
+	{ return m_size == 0; }
+	
+	string str() const
+	{ return string(m_data, m_size); }
+	
+	bool isChildOf(StringRef parent) const
+	{ return FileName::isParentOf(parent, view()); }
+	
+	friend std::ostream& operator<<(std::ostream& strm, PathBuilder const& path)
+	{
+		return strm.write(path.m_data, path.m_size);
+	}
+protected:
+	void _reserve(size_t size);
+protected:
+	char* m_data;
+	size_t m_size;
+	size_t m_capacity;           // without terminating NUL
+	char m_inline[INLINE_SIZE + 1];
+};
+
 }
 
 #endif
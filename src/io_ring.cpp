@@ -0,0 +1,204 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "io_ring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <vector>
+
+namespace tlmodder {
+
+namespace {
+
+int sysSetup(unsigned entries, struct io_uring_params* params)
+{
+	return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return (int)::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int sysRegister(int fd, unsigned opcode, void* arg, unsigned numArgs)
+{
+	return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+}
+
+template<typename T>
+T* ringField(void* ring, uint32_t offset)
+{
+	return (T*)((char*)ring + offset);
+}
+
+}
+
+IoRing::IoRing(unsigned entries, std::initializer_list<uint8_t> ops):
+	m_sqRing(MAP_FAILED),
+	m_cqRing(MAP_FAILED),
+	m_sqes((struct io_uring_sqe*)MAP_FAILED),
+	m_sqLocalTail(0),
+	m_queued(0)
+{
+	struct io_uring_params params;
+	
+	std::memset(&params, 0, sizeof(params));
+	
+	if ((m_fd = sysSetup(entries, &params)) == -1)
+		throw NotAvailable("io_uring_setup() failed");
+	
+	try {
+		_probe(ops);
+		
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		
+		// Both rings share one mapping on newer kernels
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+		{
+			if (m_cqRingSize > m_sqRingSize)
+				m_sqRingSize = m_cqRingSize;
+			m_cqRingSize = m_sqRingSize;
+		}
+		
+		m_sqRing = ::mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+		if (m_sqRing == MAP_FAILED)
+			throw NotAvailable("cannot map io_uring submission queue");
+		
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			m_cqRing = m_sqRing;
+		else
+		{
+			m_cqRing = ::mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+			if (m_cqRing == MAP_FAILED)
+				throw NotAvailable("cannot map io_uring completion queue");
+		}
+		
+		m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_sqes = (struct io_uring_sqe*)::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED)
+			throw NotAvailable("cannot map io_uring submission entries");
+	}
+	catch (...)
+	{
+		_close();
+		throw;
+	}
+	
+	m_sqHead = ringField<unsigned>(m_sqRing, params.sq_off.head);
+	m_sqTail = ringField<unsigned>(m_sqRing, params.sq_off.tail);
+	m_sqMask = *ringField<unsigned>(m_sqRing, params.sq_off.ring_mask);
+	m_sqEntries = *ringField<unsigned>(m_sqRing, params.sq_off.ring_entries);
+	m_sqArray = ringField<unsigned>(m_sqRing, params.sq_off.array);
+	m_sqLocalTail = *m_sqTail;
+	
+	m_cqHead = ringField<unsigned>(m_cqRing, params.cq_off.head);
+	m_cqTail = ringField<unsigned>(m_cqRing, params.cq_off.tail);
+	m_cqMask = *ringField<unsigned>(m_cqRing, params.cq_off.ring_mask);
+	m_cqes = ringField<struct io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+}
+
+IoRing::~IoRing()
+{
+	_close();
+}
+
+void IoRing::_close()
+{
+	if (m_sqes != MAP_FAILED)
+		::munmap(m_sqes, m_sqesSize);
+	
+	if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+		::munmap(m_cqRing, m_cqRingSize);
+	
+	if (m_sqRing != MAP_FAILED)
+		::munmap(m_sqRing, m_sqRingSize);
+	
+	::close(m_fd);
+}
+
+void IoRing::_probe(std::initializer_list<uint8_t> ops)
+{
+	const unsigned numOps = 256;
+	std::vector<char> buf(sizeof(struct io_uring_probe) + numOps * sizeof(struct io_uring_probe_op));
+	struct io_uring_probe* probe = (struct io_uring_probe*)buf.data();
+	
+	// Probing itself is supported since the same kernel as opening files
+	if (sysRegister(m_fd, IORING_REGISTER_PROBE, probe, numOps) != 0)
+		throw NotAvailable("io_uring is too old");
+	
+	for (uint8_t op : ops)
+	{
+		if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			throw NotAvailable("io_uring doesn't support all needed operations");
+	}
+}
+
+struct io_uring_sqe* IoRing::sqe()
+{
+	struct io_uring_sqe* entry;
+	unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+	
+	if (m_sqLocalTail - head >= m_sqEntries)
+		return nullptr;
+	
+	entry = &m_sqes[m_sqLocalTail & m_sqMask];
+	m_sqArray[m_sqLocalTail & m_sqMask] = m_sqLocalTail & m_sqMask;
+	++m_sqLocalTail;
+	++m_queued;
+	
+	std::memset(entry, 0, sizeof(*entry));
+	return entry;
+}
+
+void IoRing::submit(unsigned minComplete)
+{
+	unsigned flags = (minComplete != 0) ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+	
+	if (m_queued == 0 && minComplete == 0)
+		return;
+	
+	__atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+	
+	for (;;)
+	{
+		ret = sysEnter(m_fd, m_queued, minComplete, flags);
+		
+		if (ret >= 0)
+			break;
+		
+		if (errno != EINTR)
+			throw std::runtime_error("io_uring_enter() failed");
+	}
+	
+	// Kernel consumes entries in order, so any not consumed are the last ones
+	m_queued -= (unsigned)ret;
+}
+
+struct io_uring_cqe const* IoRing::peek()
+{
+	unsigned head = *m_cqHead;
+	
+	if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+		return nullptr;
+	
+	return &m_cqes[head & m_cqMask];
+}
+
+void IoRing::pop()
+{
+	__atomic_store_n(m_cqHead, *m_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+}
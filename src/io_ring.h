@@ -0,0 +1,88 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_IO_RING_H__
+#define __TLMODDER_IO_RING_H__
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace tlmodder {
+
+// Minimal io_uring on top of raw system calls
+// Submission and completion queues are mapped from the kernel and accessed
+// directly, io_uring_enter() is only called to submit queued entries and to
+// wait for completions.
+class IoRing
+{
+public:
+	class NotAvailable : public std::runtime_error
+	{
+	public:
+		NotAvailable(char const* reason):
+			std::runtime_error(reason)
+		{}
+	};
+	
+	// Throws NotAvailable if the kernel doesn't support io_uring or any of
+	// operations in 'ops', which are IORING_OP_* values
+	IoRing(unsigned entries, std::initializer_list<uint8_t> ops);
+	~IoRing();
+	
+	IoRing(IoRing const&) = delete;
+	IoRing& operator=(IoRing const&) = delete;
+	
+	// Returns cleared entry to fill in, or nullptr if submission queue is full
+	struct io_uring_sqe* sqe();
+	
+	// Submits queued entries and waits until at least minComplete completions are available
+	void submit(unsigned minComplete = 0);
+	
+	// Returns oldest completion without removing it, or nullptr if there is none
+	struct io_uring_cqe const* peek();
+	
+	// Removes completion returned by peek()
+	void pop();
+	
+	// Number of entries queued since the last submit()
+	unsigned queued() const
+	{ return m_queued; }
+protected:
+	void _probe(std::initializer_list<uint8_t> ops);
+	void _close();
+protected:
+	int m_fd;
+	
+	void* m_sqRing;
+	void* m_cqRing;
+	size_t m_sqRingSize;
+	size_t m_cqRingSize;
+	struct io_uring_sqe* m_sqes;
+	size_t m_sqesSize;
+	
+	unsigned* m_sqHead;
+	unsigned* m_sqTail;
+	unsigned m_sqMask;
+	unsigned m_sqEntries;
+	unsigned* m_sqArray;
+	unsigned m_sqLocalTail;   // tail including entries not yet made visible to kernel
+	unsigned m_queued;
+	
+	unsigned* m_cqHead;
+	unsigned* m_cqTail;
+	unsigned m_cqMask;
+	struct io_uring_cqe* m_cqes;
+};
+
+}
+
+#endif
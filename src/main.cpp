@@ -11,6 +11,7 @@
 #include <limits>
 
 #include "config.h"
+#include "modchecker.h"
 #include "modcompiler.h"
 #include "dat_file_adm_loader.h"
 #include "dir_iterator.h"
@@ -26,13 +27,33 @@ using std::string;
 int main(int argc, char **argv)
 {
 	Config config;
+	string configFn = "./tlmodder.cfg";
+	bool checkOnly = false;
+	bool watch = false;
+	bool linkAssets = false;
+	
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		
+		if (arg == "--check")
+			checkOnly = true;
+		else if (arg == "--watch")
+			watch = true;
+		else if (arg == "--link-assets")
+			linkAssets = true;
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			std::cerr << "Usage: " << argv[0] << " [--check | --watch] [--link-assets] [config_file]" << std::endl;
+			return 1;
+		}
+		else
+			configFn = arg;
+	}
 	
 	// Load config file
 	try {
-		if (argc > 1)
-			config.loadFrom(argv[1]);
-		else
-			config.loadFrom("./tlmodder.cfg");
+		config.loadFrom(configFn);
 	}
 	catch (MappedFile::MappingFailed&)
 	{
@@ -50,6 +71,12 @@ int main(int argc, char **argv)
 	bool hadWarning = false;
 	
 	compiler.outputDir(config.outputDir());
+	compiler.scanCacheDir(config.scanCacheDir());
+	compiler.prefetchDistance(config.prefetchDistance());
+	compiler.threads(config.compileThreads());
+	compiler.ioUring(config.ioUring());
+	compiler.preserveAttributes(config.preserveAttributes());
+	compiler.linkAssets(linkAssets || config.linkAssets());
 	compiler.mergeClasses(config.mergeClassMods());
 	
 	// Add original game data, quit on failure
@@ -71,7 +98,7 @@ int main(int argc, char **argv)
 	
 	if (config.lookForNew())
 	try {
-		struct stat st;
+		DirIterator::EntryType type;
 		
 		ModConfig modConfig;
 		DirIterator it(config.modDir());
@@ -79,14 +106,10 @@ int main(int argc, char **argv)
 		modConfig.priority = std::numeric_limits<int>::min();
 		modConfig.enabled = true;
 		
-		while (it.next(modConfig.name))
+		while (it.next(modConfig.name, type))
 		{
-			// Skip the file if we cannot stat it
-			if (!it.stat(modConfig.name, st, false))
-				continue;
-			
 			// If it is directory
-			if (S_ISDIR(st.st_mode))
+			if (type == DirIterator::TYPE_DIR)
 			{
 				// And if it isn't present in config file, add it to the list
 				if (config.modConfigs().find(modConfig) == config.modConfigs().end())
@@ -112,9 +135,7 @@ int main(int argc, char **argv)
 		modPath.cd(modConfig.name);
 		
 		try {
-			ModDirectory mod;
-			mod.loadFromDir(modPath.str());
-			compiler.addMod(std::move(mod));
+			compiler.addMod(modPath.str());
 		}
 		catch (DirIterator::OpenFailed& e)
 		{
@@ -124,6 +145,22 @@ int main(int argc, char **argv)
 		}
 	}
 	
+	// Only look for errors in DAT files and quit
+	if (checkOnly)
+	{
+		ModChecker checker;
+		size_t numErrors;
+		
+		std::cerr << "Checking DAT files" << std::endl;
+		checker.check(compiler.files());
+		numErrors = checker.report(std::cout);
+		
+		std::cerr << "Checked " << checker.numFiles() << " files, found " << numErrors << " errors and "
+		          << checker.errors().size() - numErrors << " warnings." << std::endl;
+		
+		return (numErrors == 0 && !hadWarning) ? 0 : 1;
+	}
+	
 	// If any mod failed to load, ask if we should continue
 	if (hadWarning)
 	{
@@ -140,7 +177,18 @@ int main(int argc, char **argv)
 			return 1;
 	}
 	
-	compiler.compile();
+	// Errors are described where they are found, this only ends the run
+	try {
+		if (watch)
+			compiler.watch();
+		else
+			compiler.compile();
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << "ERROR: Compilation failed: " << e.what() << std::endl;
+		return 1;
+	}
 	
 	return 0;
 }
@@ -13,21 +13,100 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <errno.h>
+
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
 
 namespace tlmodder
 {
 
-MappedFile::MappedFile(string const& path)
+namespace
+{
+
+// Buffers of READ_THRESHOLD bytes for small files
+// Released buffers are kept for reuse, up to MAX_FREE of them, so that loading
+// many small files allocates only few buffers. Shared by all threads.
+class BufferPool
+{
+public:
+	static const size_t MAX_FREE = 64;
+	
+	~BufferPool()
+	{
+		for (char* buf : m_free)
+			std::free(buf);
+	}
+	
+	char* acquire()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			
+			if (!m_free.empty())
+			{
+				char* buf = m_free.back();
+				m_free.pop_back();
+				return buf;
+			}
+		}
+		
+		char* buf = (char*)std::malloc(MappedFile::READ_THRESHOLD);
+		
+		if (buf == nullptr)
+			throw std::bad_alloc();
+		
+		return buf;
+	}
+	
+	void release(char* buf)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			
+			if (m_free.size() < MAX_FREE)
+			{
+				m_free.push_back(buf);
+				return;
+			}
+		}
+		
+		std::free(buf);
+	}
+protected:
+	std::mutex m_mutex;
+	std::vector<char*> m_free;
+};
+
+BufferPool& bufferPool()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+// ptr() of empty file
+char emptyFile[1] = {0};
+
+}
+
+MappedFile::MappedFile(string const& path, unsigned flags)
+{
+	_mapfd(::open(path.c_str(), O_RDONLY | O_CLOEXEC), flags);
+}
+
+MappedFile::MappedFile(DirIterator const& dir, string const& path, unsigned flags)
 {
-	_mapfd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+	_mapfd(dir.open(path, O_RDONLY | O_CLOEXEC), flags);
 }
 
-MappedFile::MappedFile(DirIterator const& dir, string const& path)
+MappedFile::MappedFile(int fd, size_t size, unsigned flags)
 {
-	_mapfd(dir.open(path, O_RDONLY | O_CLOEXEC));
+	_map(fd, size, flags);
 }
 
-void MappedFile::_mapfd(int fd)
+void MappedFile::_mapfd(int fd, unsigned flags)
 {
 	if (fd == -1)
 		throw MappingFailed("cannot open file");
@@ -40,18 +119,83 @@ void MappedFile::_mapfd(int fd)
 	}
 	
 	// FIXME: check if file size negative or value too large to cast to size_t
-	m_size = (size_t)st.st_size;
+	try {
+		_map(fd, (size_t)st.st_size, flags);
+	}
+	catch (...)
+	{
+		::close(fd);
+		throw;
+	}
 	
-	m_ptr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	::close(fd);
+}
+
+void MappedFile::_map(int fd, size_t size, unsigned flags)
+{
+	m_mapped = false;
+	
+	if (size < READ_THRESHOLD)
+	{
+		_read(fd, size);
+		return;
+	}
+	
+	m_size = size;
+	m_ptr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE | ((flags & POPULATE) ? MAP_POPULATE : 0), fd, 0);
 	
 	if (m_ptr == MAP_FAILED)
 		throw MappingFailed("mmap() failed");
+	
+	m_mapped = true;
+	
+	// Only a hint, failure doesn't matter
+	::madvise(m_ptr, m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::_read(int fd, size_t size)
+{
+	char* buf;
+	ssize_t len;
+	
+	m_ptr = emptyFile;
+	m_size = 0;
+	
+	if (size == 0)
+		return;
+	
+	buf = bufferPool().acquire();
+	
+	// File may be shorter than expected if it was truncated meanwhile
+	while (m_size < size)
+	{
+		len = ::pread(fd, buf + m_size, size - m_size, (off_t)m_size);
+		
+		if (len == -1 && errno == EINTR)
+			continue;
+		
+		if (len == -1)
+		{
+			bufferPool().release(buf);
+			m_size = 0;
+			throw MappingFailed("pread() failed");
+		}
+		
+		if (len == 0)
+			break;
+		
+		m_size += (size_t)len;
+	}
+	
+	m_ptr = buf;
 }
 
 MappedFile::~MappedFile()
 {
-	::munmap(m_ptr, m_size);
+	if (m_mapped)
+		::munmap(m_ptr, m_size);
+	else if (m_ptr != emptyFile)
+		bufferPool().release((char*)m_ptr);
 }
 
 } // namespace tlmodder
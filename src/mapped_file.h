@@ -23,13 +23,33 @@ using std::string;
 using std::size_t;
 using std::uint8_t;
 
+// Read-only view of whole file in memory
+// Files smaller than READ_THRESHOLD are read with pread() into buffer borrowed
+// from a pool shared by all MappedFiles, since mapping and unmapping costs more
+// than copying few pages. Larger files are mapped for sequential access, with
+// POPULATE also faulted in at once, which pays off when the caller is going to
+// read whole file anyway. Empty file has size() of 0 and valid ptr().
 class MappedFile
 {
 public:
-	MappedFile(string const& path);
-	MappedFile(DirIterator const& dir, string const& path);
+	enum Flags : unsigned
+	{
+		POPULATE = 1        // prefault mapping of large file (MAP_POPULATE)
+	};
+	
+	static const size_t READ_THRESHOLD = 64 * 1024;
+	
+	MappedFile(string const& path, unsigned flags = 0);
+	MappedFile(DirIterator const& dir, string const& path, unsigned flags = 0);
+	
+	// Maps first 'size' bytes of already opened file, fd is left open
+	MappedFile(int fd, size_t size, unsigned flags = 0);
+	
 	~MappedFile();
 	
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+	
 	const uint8_t* ptr() const { return (const uint8_t*)m_ptr; }
 	size_t size() const { return m_size; }
 	
@@ -41,10 +61,13 @@ public:
 		{}
 	};
 protected:
-	void _mapfd(int fd);
+	void _mapfd(int fd, unsigned flags);
+	void _map(int fd, size_t size, unsigned flags);
+	void _read(int fd, size_t size);
 protected:
 	void* m_ptr;
 	size_t m_size;
+	bool m_mapped;          // m_ptr is mapping, otherwise pooled buffer or empty buffer
 };
 
 } // namespace tlmodder
@@ -10,7 +10,6 @@
 #define __TLMODDER_MASSFILE_H__
 
 #include "adm.h"
-#include "filename_utils.h"
 
 namespace tlmodder {
 
@@ -32,8 +31,6 @@ public:
 		it->name = addString(std::move(fileName));
 		mergeNodes(sourceAdm, sourceNode, *it, adm::AttributeReplaceMode::DontReplace);
 	}
-	
-	static bool isDirWhitelisted(FileName const& mod_dir);
 };
 
 }
@@ -10,6 +10,8 @@
 #define __TLMODDER_MASTERRESUNITS_H__
 
 #include "adm.h"
+#include "filename_utils.h"
+#include "moddirectory.h"
 
 namespace tlmodder {
 
@@ -46,24 +48,30 @@ public:
 		m_resourceStrings[PROPS]    = addString("PROPS");
 	}
 	
-	void addUnit(std::string fileitem, FileName const& modDir, adm::Adm const& adm)
+	// category is category of modDir, only unit group directories are accepted
+	void addUnit(std::string fileitem, StringRef modDir, DirCategory category, adm::Adm const& adm)
 	{
 		uint32_t itemtype;
 		adm::NodeIterator node;
 		
-		if (modDir.isChildOf("MEDIA/UNITS/ITEMS"))
-			itemtype = ITEMS;
-		else if (modDir.isChildOf("MEDIA/UNITS/MONSTERS"))
-			itemtype = MONSTERS;
-		else if (modDir.isChildOf("MEDIA/UNITS/PLAYERS"))
-			itemtype = PLAYERS;
-		else if (modDir.isChildOf("MEDIA/UNITS/PROPS"))
-			itemtype = PROPS;
-		else
+		switch (category)
 		{
-			std::cerr << "WARNING: I don't know what section to put " << modDir.build(fileitem)
-			          << " into." << std::endl;
-			return;
+			case DirCategory::UnitsItems:
+				itemtype = ITEMS;
+				break;
+			case DirCategory::UnitsMonsters:
+				itemtype = MONSTERS;
+				break;
+			case DirCategory::UnitsPlayers:
+				itemtype = PLAYERS;
+				break;
+			case DirCategory::UnitsProps:
+				itemtype = PROPS;
+				break;
+			default:
+				std::cerr << "WARNING: I don't know what section to put " << FileName::build(modDir.str(), fileitem)
+				          << " into." << std::endl;
+				return;
 		}
 		
 		node = m_root.insertSubnode();
@@ -75,7 +83,7 @@ public:
 		
 		node->setAttribute(DONTCREATE_STR, false);
 		node->setAttribute(RESOURCEGROUP_STR, itemtype);
-		node->setAttribute(DATAFILE_STR, stringAttribute(modDir.build(fileitem)));
+		node->setAttribute(DATAFILE_STR, stringAttribute(FileName::build(modDir.str(), fileitem)));
 		node->setAttribute(FILEITEM_STR, stringAttribute(fileitem));
 	}
 };
@@ -0,0 +1,153 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "modchecker.h"
+#include "dat_file_adm_loader.h"
+#include "filename_utils.h"
+#include "unicode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stack>
+#include <thread>
+#include <tuple>
+
+namespace tlmodder {
+
+void ModChecker::_collectFiles(FrozenModDirectory const& files, std::vector<string>& out)
+{
+	using ModDirState      = std::pair<FrozenModDir const*, FrozenModDir const*>; // directory, next subdirectory
+	using ModDirStateStack = std::stack<ModDirState>;
+	
+	ModDirStateStack stateStack;
+	
+	stateStack.push(std::make_pair(&files.root(), files.dirs(files.root()).begin()));
+	
+	while (!stateStack.empty())
+	{
+		ModDirState& state = stateStack.top();
+		FrozenModDir const& modDir = *state.first;
+		
+		if (state.second == files.dirs(modDir).begin())
+		{
+			for (FrozenModFile const& file : files.files(modDir))
+			{
+				// Check files from all mods, not just the one which wins
+				for (ModSource const& source : files.sources(file))
+				{
+					if (!isDatFileType(source.type) || isAdmFileType(source.type))
+						continue;
+					
+					// Layouts in UI directory are XML files
+					if (source.type == FileType::Layout && modDir.category == DirCategory::Ui)
+						continue;
+					
+					out.push_back(source.path());
+				}
+			}
+		}
+		
+		if (state.second != files.dirs(modDir).end())
+		{
+			FrozenModDir const& childDir = *state.second;
+			
+			stateStack.push(std::make_pair(&childDir, files.dirs(childDir).begin()));
+			++state.second;
+		}
+		else
+		{
+			stateStack.pop();
+		}
+	}
+}
+
+void ModChecker::_checkFile(string const& fn, std::vector<Error>& errors)
+{
+	adm::DatFileLoader::ErrorList loaderErrors;
+	adm::Adm adm;
+	
+	try {
+		adm::DatFileLoader loader(fn);
+		loader.check(adm, loaderErrors);
+	}
+	catch (MappedFile::MappingFailed& e)
+	{
+		errors.push_back({fn, 0, "io", string("cannot read file: ") + e.what(), false});
+	}
+	catch (std::exception& e)
+	{
+		errors.push_back({fn, 0, "error", e.what(), false});
+	}
+	
+	for (auto const& e : loaderErrors)
+		errors.push_back({fn, e->lineNumber(), e->kind(), e->describe(), e->isWarning()});
+}
+
+void ModChecker::check(FrozenModDirectory const& files)
+{
+	std::vector<string> fileNames;
+	std::vector<std::vector<Error>> fileErrors;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> nextFile(0);
+	unsigned numThreads;
+	
+	_collectFiles(files, fileNames);
+	
+	m_numFiles = fileNames.size();
+	fileErrors.resize(fileNames.size());
+	
+	numThreads = m_threads;
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	
+	auto worker = [&]()
+	{
+		size_t i;
+		
+		while ((i = nextFile.fetch_add(1)) < fileNames.size())
+			_checkFile(fileNames[i], fileErrors[i]);
+	};
+	
+	for (unsigned i = 1; i < numThreads; ++i)
+		workers.emplace_back(worker);
+	
+	worker();
+	
+	for (std::thread& thread : workers)
+		thread.join();
+	
+	m_errors.clear();
+	for (auto& errors : fileErrors)
+	{
+		for (Error& error : errors)
+			m_errors.push_back(std::move(error));
+	}
+	
+	std::stable_sort(m_errors.begin(), m_errors.end(), [](Error const& e1, Error const& e2)
+	{
+		return std::tie(e1.file, e1.line) < std::tie(e2.file, e2.line);
+	});
+}
+
+size_t ModChecker::report(std::ostream& strm) const
+{
+	size_t numErrors = 0;
+	
+	for (Error const& error : m_errors)
+	{
+		strm << error.file << ":" << error.line << ": " << error.kind << ": " << error.message << "\n";
+		
+		if (!error.warning)
+			++numErrors;
+	}
+	
+	strm.flush();
+	return numErrors;
+}
+
+}
@@ -0,0 +1,69 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_MODCHECKER_H__
+#define __TLMODDER_MODCHECKER_H__
+
+#include "moddirectory.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace tlmodder {
+
+using std::string;
+
+// Parses all textual DAT, LAYOUT and ANIMATION files of merged mod tree
+// in parallel and reports every error found, not just the first one.
+class ModChecker
+{
+public:
+	struct Error
+	{
+		string file;     // on-disk file name
+		int    line;
+		string kind;
+		string message;
+		bool   warning;
+	};
+	
+	ModChecker():
+		m_threads(0),
+		m_numFiles(0)
+	{}
+	
+	// Number of worker threads, 0 means number of CPUs
+	unsigned threads() const
+	{ return m_threads; }
+	
+	void threads(unsigned numThreads)
+	{ m_threads = numThreads; }
+	
+	void check(FrozenModDirectory const& files);
+	
+	// Prints errors sorted by file and line, returns number of errors (not warnings)
+	size_t report(std::ostream& strm) const;
+	
+	std::vector<Error> const& errors() const
+	{ return m_errors; }
+	
+	size_t numFiles() const
+	{ return m_numFiles; }
+protected:
+	void _collectFiles(FrozenModDirectory const& files, std::vector<string>& out);
+	static void _checkFile(string const& fn, std::vector<Error>& errors);
+protected:
+	unsigned m_threads;
+	size_t m_numFiles;
+	std::vector<Error> m_errors;
+};
+
+}
+
+#endif
@@ -10,52 +10,236 @@
 #include "adm_file_writer.h"
 #include "modcompiler.h"
 #include "charactercreate.h"
+#include "file_copy.h"
+#include "output_writer.h"
+#include "ordered_runner.h"
+#include "prefetcher.h"
+#include "task_graph.h"
 
-#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
 
 namespace tlmodder {
 
 using std::stack;
 
-void ModCompiler::copyFile(string const& src, string const& dst)
+namespace {
+
+// Files which may be compiled ahead of the oldest one not applied yet, per
+// thread, results of all of them are kept in memory
+const unsigned JOB_WINDOW_PER_THREAD = 16;
+
+// BASEFILE path in the form of upper-cased in-mod paths used by watch mode,
+// without leading and repeated slashes
+string normalizeBaseFile(string const& baseFn)
 {
-	try
+	string path;
+	
+	for (size_t pos = 0, slash; pos < baseFn.size(); pos = slash + 1)
 	{
-		std::ifstream infile;
-		std::ofstream outfile;
+		slash = baseFn.find('/', pos);
+		if (slash == string::npos)
+			slash = baseFn.size();
 		
-		infile.exceptions(std::ios::badbit);
-		outfile.exceptions(std::ios::badbit);
+		if (slash != pos)
+			FileName::buildInplace(path, baseFn.substr(pos, slash - pos));
+	}
+	
+	return path;
+}
+
+// Reads BASEFILE attribute of adm as upper-cased path, false if it has none
+bool getBaseFile(adm::Adm& adm, string& baseFn)
+{
+	adm::AttributeIterator attr;
+	uint32_t BASEFILE_id;
+	
+	if (!adm.stringMap().find("BASEFILE", BASEFILE_id))
+		return false;
+	
+	attr = adm.root().attributes.find(BASEFILE_id);
+	
+	if (attr == adm.root().attributes.end() || attr->second.type != adm::AttributeValue::TYPE_STRING)
+		return false;
+	
+	baseFn = adm.getString(attr->second.valu32);
+	FileName::winSlashesToPosix(baseFn);
+	utf8_to_upper_inplace(baseFn);
+	
+	return true;
+}
+
+// Describes error of loading DAT file the same way as _loadDat() logs it
+string formatLoadError(std::exception_ptr error)
+{
+	try {
+		std::rethrow_exception(error);
+	}
+	catch (adm::DatFileLoader::Exception& e)
+	{
+		return e.format();
+	}
+	catch (std::exception& e)
+	{
+		return string("ERROR: ") + e.what();
+	}
+	catch (...)
+	{
+		return "ERROR: unknown error";
+	}
+}
+
+// Sources of units are loaded ahead by _resolveBases(), other files when they are compiled
+bool isUnitDat(DirCategory category, FileType type)
+{
+	return isUnitsCategory(category) && (type == FileType::Dat || type == FileType::DatAdm);
+}
+
+bool isDontCreate(adm::Adm& adm)
+{
+	adm::AttributeIterator attr;
+	uint32_t DONTCREATE_id;
+	
+	if (!adm.stringMap().find("DONTCREATE", DONTCREATE_id))
+		return false;
+	
+	attr = adm.root().attributes.find(DONTCREATE_id);
+	
+	return attr != adm.root().attributes.end() && attr->second.type == adm::AttributeValue::TYPE_BOOL &&
+	       attr->second.valu32 == 1;
+}
+
+}
+
+void ModCompiler::copyFile(std::ostream& log, string const& src, string const& dst)
+{
+	bool unchanged = isCopyOf(src, dst, m_preserveAttributes);
+	
+	{
+		std::lock_guard<std::mutex> lock(m_outputMutex);
 		
-		infile.open(src, std::ios::binary);
-		outfile.open(dst, std::ios::binary | std::ios::trunc);
+		m_outputFiles.insert(dst);
 		
-		outfile << infile.rdbuf(); // FIXME: kinda slow
+		if (unchanged)
+		{
+			++m_numUnchanged;
+			return;
+		}
 		
-		infile.close();
-		outfile.close();
+		++m_numWritten;
 	}
-	catch (...)
+	
+	if (m_writer)
 	{
-		std::cerr << "Failed to copy " << src << " into output directory." << std::endl;
+		m_writer->copy(src, dst);
+		return;
+	}
+	
+	try {
+		copyFileData(src, dst, m_preserveAttributes);
+	}
+	catch (std::exception& e)
+	{
+		log << "Failed to copy " << src << " into output directory: " << e.what() << std::endl;
 		throw;
 	}
 }
 
-void ModCompiler::processDat(ModFileEntry const& entry, ExtInfo const& extInfo)
+void ModCompiler::linkOrCopyFile(std::ostream& log, string const& src, string const& dst)
 {
-	std::shared_ptr<adm::Adm> admPtr;
+	string target = (src[0] == '/') ? src : FileName::build(m_workDir, src);
 	
-	std::cerr << "Compiling " << m_currentModDir.build(entry.first) << std::endl;
+	if (isLinkTo(target, dst))
+	{
+		std::lock_guard<std::mutex> lock(m_outputMutex);
+		
+		m_outputFiles.insert(dst);
+		++m_numUnchanged;
+		return;
+	}
+	
+	if (m_writer)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_outputMutex);
+			
+			m_outputFiles.insert(dst);
+			++m_numWritten;
+		}
+		
+		m_writer->link(target, dst);
+		return;
+	}
+	
+	if (linkFile(target, dst))
+	{
+		std::lock_guard<std::mutex> lock(m_outputMutex);
+		
+		m_outputFiles.insert(dst);
+		++m_numWritten;
+	}
+	else
+	{
+		copyFile(log, src, dst);
+	}
+}
+
+void ModCompiler::writeOutput(std::ostream& log, string const& path, string&& data)
+{
+	bool unchanged = fileHasContents(path, data.data(), data.size());
+	
+	{
+		std::lock_guard<std::mutex> lock(m_outputMutex);
+		
+		m_outputFiles.insert(path);
+		
+		if (unchanged)
+		{
+			++m_numUnchanged;
+			return;
+		}
+		
+		++m_numWritten;
+	}
+	
+	if (m_writer)
+	{
+		m_writer->write(path, std::move(data));
+		return;
+	}
 	
 	try {
-		admPtr = adm::Adm::createFromFile(entry.second.front());
+		writeFileData(path, data.data(), data.size());
 	}
-	catch (adm::DatFileLoader::Exception& e)
+	catch (std::exception& e)
 	{
-		std::cerr << e.format() << std::endl;
+		log << "Failed to write " << path << ": " << e.what() << std::endl;
 		throw;
 	}
+}
+
+void ModCompiler::writeOutput(std::ostream& log, string const& path, adm::Adm const& adm)
+{
+	std::ostringstream strm;
+	
+	adm::admFileWrite(strm, adm);
+	writeOutput(log, path, strm.str());
+}
+
+void ModCompiler::processDat(FileJob& job, ExtInfo const& extInfo)
+{
+	std::shared_ptr<adm::Adm> admPtr;
+	
+	// Units are loaded by _resolveBases()
+	if (job.adm)
+		admPtr = std::move(job.adm);
+	else
+		admPtr = _loadDat(job);
 	
 	// Create LAYOUT.CMP file for LAYOUT files
 	if (extInfo.isLayout)
@@ -64,44 +248,46 @@ void ModCompiler::processDat(ModFileEntry const& entry, ExtInfo const& extInfo)
 		//       mods seem to work without it and reads source one, so just copy it
 		
 		if (!extInfo.isAdm)
-			copyFile(entry.second.front(), m_currentDir.build(entry.first));
+			copyFile(job.log, m_files.source(*job.file).path(), job.outputPath);
 	}
 	
-	if ((extInfo.isDat || extInfo.isAnimation) && m_massfile.isDirWhitelisted(m_currentModDirUpper))
+	// Added to MASSFILE or MASTERRESOURCEUNITS by _commitFile()
+	if ((extInfo.isDat || extInfo.isAnimation) && isMassFileCategory(job.category))
 	{
-		std::cerr << "Adding " << m_currentModDir.build(entry.first) << " to massfile" << std::endl;
-		m_massfile.addFile(*admPtr, admPtr->root(), m_currentModDirUpper.build(utf8_to_upper(entry.first)));
+		job.log << "Adding " << job.modPath << " to massfile" << std::endl;
+		job.compiled.massFileAdm = admPtr;
 	}
-	else if (extInfo.isDat && m_currentModDirUpper.isChildOf("MEDIA/UNITS"))
+	else if (extInfo.isDat && isUnitsCategory(job.category))
 	{
-		std::cerr << "Adding " << m_currentModDir.build(entry.first) << " to masterresourceunits" << std::endl;
-		addToMasterResourceUnits(entry, admPtr);
+		job.log << "Adding " << job.modPath << " to masterresourceunits" << std::endl;
+		addToMasterResourceUnits(job, admPtr);
 	}
 	
-	adm::admFileWrite(m_currentDir.build(entry.first) + ".adm", *admPtr);
+	writeOutput(job.log, job.outputPath + ".adm", *admPtr);
 }
 
 void ModCompiler::loadClasses()
 {
-	ModDirectoryIterator dirIt;
-	ModFileIterator playerDatEntry;
+	FrozenModDir const* playersDir;
+	FrozenModFile const* playerDat;
 	adm::AttributeIterator attr;
 	uint32_t UNIT_id, NAME_id;
 	
-	if (!m_files.lookupDir("MEDIA/UNITS/PLAYERS", dirIt))
+	playersDir = m_files.lookupDir("MEDIA/UNITS/PLAYERS");
+	if (playersDir == nullptr)
 		return;
 	
-	for (ModDirectoryEntry& player : dirIt->second.dirs)
+	for (FrozenModDir const& player : m_files.dirs(*playersDir))
 	{
-		playerDatEntry = player.second.files.find(player.first + ".dat");
+		playerDat = m_files.findFile(player, player.name + ".dat");
 		
-		if (playerDatEntry == player.second.files.end())
+		if (playerDat == nullptr)
 			continue;
 		
 		try {
 			adm::Adm adm;
 			
-			adm.loadFromFile(playerDatEntry->second.front());
+			adm.loadFromFile(m_files.source(*playerDat).path());
 			
 			// Player DAT file must contain UNIT and NAME strigs and root's name must be UNIT
 			if (adm.stringMap().find("UNIT", UNIT_id) &&
@@ -131,38 +317,67 @@ void ModCompiler::loadClasses()
 
 void ModCompiler::addMod(ModDirectory&& mod)
 {
-	m_files.merge(std::move(mod));
+	if (m_isFrozen)
+		throw std::logic_error("Cannot add mod, file tree is already frozen");
+	
+	m_mods.merge(std::move(mod));
 }
 
 void ModCompiler::addMod(std::string const& modPath)
 {
-	m_files.loadFromDir(modPath);
+	if (m_isFrozen)
+		throw std::logic_error("Cannot add mod, file tree is already frozen");
+	
+	m_mods.loadFromDir(modPath, m_scanCacheDir.str());
+	m_modPaths.push_back(modPath);
 }
 
-void ModCompiler::processFile(ModFileEntry const& entry)
+FrozenModDirectory const& ModCompiler::files()
+{
+	if (!m_isFrozen)
+	{
+		m_files = m_mods.freeze();
+		m_files.buildPathIndex();
+		m_mods = ModDirectory();
+		m_isFrozen = true;
+	}
+	
+	return m_files;
+}
+
+void ModCompiler::processFile(FileJob& job)
 {
 	ExtInfo extInfo;
-	string ext;
+	FileType type;
 	
-	ext = utf8_to_upper(FileName::extension(entry.first));
+	type = m_files.source(*job.file).type;
 	
-	extInfo.isDat = (ext == "DAT");
-	extInfo.isAnimation = (ext == "ANIMATION");
-	extInfo.isLayout = (ext == "LAYOUT");
-	extInfo.isAdm = (utf8_to_upper(FileName::extension(entry.second.front())) == "ADM");
+	extInfo.isDat = (type == FileType::Dat || type == FileType::DatAdm);
+	extInfo.isAnimation = (type == FileType::Animation || type == FileType::AnimationAdm);
+	extInfo.isLayout = (type == FileType::Layout || type == FileType::LayoutAdm);
+	extInfo.isAdm = isAdmFileType(type);
 	
-	if (extInfo.isLayout && !extInfo.isAdm && m_currentModDirUpper.isChildOf("MEDIA/UI"))
+	if (extInfo.isLayout && !extInfo.isAdm && job.category == DirCategory::Ui)
 		extInfo.isLayout = false;
 	
 	extInfo.isDatFile = extInfo.isDat || extInfo.isAnimation || extInfo.isLayout;
 	
 	if (extInfo.isDatFile)
 	{
-		processDat(entry, extInfo);
+		processDat(job, extInfo);
+	}
+	else if (mergeClasses() && job.category == DirCategory::Ui &&
+	         job.file->key == "CHARACTERCREATE.LAYOUT" && job.modDirUpper == "MEDIA/UI")
+	{
+		// Generated at the end by createCharacterCreateLayout(), copy would only be replaced
+	}
+	else if (m_linkAssets)
+	{
+		linkOrCopyFile(job.log, m_files.source(*job.file).path(), job.outputPath);
 	}
 	else
 	{
-		copyFile(entry.second.front(), m_currentDir.build(entry.first));
+		copyFile(job.log, m_files.source(*job.file).path(), job.outputPath);
 	}
 }
 
@@ -175,20 +390,20 @@ void ModCompiler::createCharacterCreateLayout()
 	
 	// TODO: clean this up
 	{
-		ModDirectoryIterator mediaIt, mediaUiIt;
-		mediaIt = m_files.dirs.find("media");
-		// FIXME: check mediaIt
-		charCreateLayoutFn.cd(mediaIt->first);
-	
-		mediaUiIt = mediaIt->second.dirs.find("UI");
-		if (mediaUiIt != mediaIt->second.dirs.end())
+		FrozenModDir const *mediaDir, *mediaUiDir;
+		mediaDir = m_files.findDir(m_files.root(), "media");
+		// FIXME: check mediaDir
+		charCreateLayoutFn.cd(mediaDir->name);
+		
+		mediaUiDir = m_files.findDir(*mediaDir, "UI");
+		if (mediaUiDir != nullptr)
 		{
-			ModFileIterator it;
-			charCreateLayoutFn.cd(mediaUiIt->first);
+			FrozenModFile const* layout;
+			charCreateLayoutFn.cd(mediaUiDir->name);
 			
-			it = mediaUiIt->second.files.find("charactercreate.layout");
-			if (it != mediaUiIt->second.files.end())
-				charCreateLayoutFn.cd(it->first);
+			layout = m_files.findFile(*mediaUiDir, "charactercreate.layout");
+			if (layout != nullptr)
+				charCreateLayoutFn.cd(layout->name);
 			else
 				charCreateLayoutFn.cd("charactercreate.layout");
 		}
@@ -209,9 +424,7 @@ void ModCompiler::createCharacterCreateLayout()
 		}
 	}
 	
-	std::ofstream outfile;
-	outfile.exceptions(std::ios::badbit);
-	outfile.open(charCreateLayoutFn.str(), std::ios::binary | std::ios::trunc);
+	std::ostringstream outfile;
 	
 	outfile << charactercreate_layout_0;
 	
@@ -219,7 +432,7 @@ void ModCompiler::createCharacterCreateLayout()
 	toppos = 233;
 	for (auto& classEntry : m_classes)
 	{
-		nameUpper = utf8_to_upper(classEntry.first);
+		utf8_to_upper(classEntry.first.data(), classEntry.first.size(), nameUpper);
 		
 		if (nameUpper == "DESTROYER" || nameUpper == "VANQUISHER" || nameUpper == "ALCHEMIST")
 			continue;
@@ -254,25 +467,108 @@ void ModCompiler::createCharacterCreateLayout()
 	
 	outfile << charactercreate_layout_2;
 	
-	outfile.close();
+	writeOutput(std::cerr, charCreateLayoutFn.str(), outfile.str());
 }
 
 void ModCompiler::compile()
 {
-	using ModDirState      = std::pair<ModDirectory const*, ModDirectoryConstIterator>;
+	files();
+	_compileTree();
+	
+	std::cerr << "Output: " << m_numWritten << " files written, " << m_numUnchanged << " unchanged, "
+	          << _countStale(m_outputDir.str()) << " stale files from earlier runs left in place" << std::endl;
+	
+	std::cerr << std::endl;
+	std::cerr << "Done! Now pack 'media' directory located in " << m_currentDir << " into ZIP archive";
+	std::cerr << " called 'pak.zip' and replace the one in game directory." << std::endl;
+	std::cerr << "Note that this program might contain bugs, don't forget to backup your save files!";
+	std::cerr << std::endl;
+}
+
+size_t ModCompiler::_countStale(string const& dir) const
+{
+	string fileName, path;
+	DirIterator::EntryType type;
+	DirIterator it;
+	size_t count = 0;
+	
+	if (!it.open(std::nothrow, dir))
+		return 0;
+	
+	while (it.next(fileName, type))
+	{
+		path = FileName::build(dir, fileName);
+		
+		if (type == DirIterator::TYPE_DIR)
+			count += _countStale(path);
+		else if (m_outputFiles.count(path) == 0)
+			++count;
+	}
+	
+	return count;
+}
+
+void ModCompiler::_compileTree()
+{
+	using ModDirState      = std::pair<FrozenModDir const*, FrozenModDir const*>; // directory, next subdirectory
 	using ModDirStateStack = std::stack<ModDirState>;
 	
 	ModDirStateStack stateStack;
+	std::vector<std::unique_ptr<FileJob>> jobs;
+	std::unique_ptr<Prefetcher> prefetcher;
+	unsigned numThreads;
+	
+	m_currentDir.assign(m_outputDir.str());
+	m_currentModDir.clear();
+	m_currentModDirUpper.clear();
+	
+	m_massfile = MassFile();
+	m_masterresourceunits = MasterResourceUnits();
+	m_classes.clear();
+	m_pets.clear();
 	
-	m_currentDir = m_outputDir;
-	m_currentModDir = {};
-	m_currentModDirUpper = {};
+	m_outputFiles.clear();
+	m_numWritten = 0;
+	m_numUnchanged = 0;
 	
 	loadClasses();
 	
-	stateStack.push(std::make_pair(&m_files, m_files.dirs.begin()));
+	// Incremental compile reads only few files, scattered over the tree
+	if (m_prefetchDistance != 0 && !m_incremental)
+	{
+		prefetcher.reset(new Prefetcher(m_files, m_prefetchDistance,
+			[this](FrozenModDir const& dir, FrozenModFile const& file)
+			{ return isUnitDat(dir.category, m_files.source(file).type); }));
+	}
 	
-	if (mkdir(m_currentDir.str().c_str(), S_IRWXU | S_IRGRP | S_IXGRP) != 0)
+	// Symbolic links to relative source paths would point elsewhere
+	if (m_linkAssets && m_workDir.empty())
+	{
+		char* workDir = ::getcwd(nullptr, 0);
+		
+		if (workDir == nullptr)
+			throw std::runtime_error("Cannot get current directory");
+		
+		m_workDir = workDir;
+		::free(workDir);
+	}
+	
+	// Errors of single files have to be reported right away while watching
+	if (m_ioUring && !m_watching)
+	{
+		try {
+			m_writer.reset(new OutputWriter(m_preserveAttributes));
+		}
+		catch (IoRing::NotAvailable& e)
+		{
+			std::cerr << "WARNING: " << e.what() << ", using blocking I/O." << std::endl;
+			m_ioUring = false;
+		}
+	}
+	
+	stateStack.push(std::make_pair(&m_files.root(), m_files.dirs(m_files.root()).begin()));
+	
+	if (mkdir(m_currentDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP) != 0)
 	{
 		if (errno != EEXIST)
 		{
@@ -284,29 +580,32 @@ void ModCompiler::compile()
 	while (!stateStack.empty())
 	{
 		ModDirState& state = stateStack.top();
-		ModDirectory const& modDir = *state.first;
+		FrozenModDir const& modDir = *state.first;
 		
-		if (state.second == modDir.dirs.begin())
+		if (state.second == m_files.dirs(modDir).begin())
 		{
-			for (auto& fileEntry : modDir.files)
-			{
-				processFile(fileEntry);
-			}
+			m_currentCategory = modDir.category;
+			
+			for (FrozenModFile const& file : m_files.files(modDir))
+				_addJob(file, jobs);
 		}
 		
-		if (state.second != modDir.dirs.end())
+		if (state.second != m_files.dirs(modDir).end())
 		{
-			ModDirectoryEntry const& childDirEntry = *state.second;
-			ModDirectory const& childDir = childDirEntry.second;
+			FrozenModDir const& childDir = *state.second;
 			
-			m_currentDir.cd(childDirEntry.first);
-			m_currentModDir.cd(childDirEntry.first);
-			m_currentModDirUpper.cd(utf8_to_upper(childDirEntry.first));
+			m_currentDir.cd(childDir.name);
+			m_currentModDir.cd(childDir.name);
+			m_currentModDirUpper.cd(childDir.key);
 			
-			stateStack.push(std::make_pair(&childDir, childDir.dirs.begin()));
+			stateStack.push(std::make_pair(&childDir, m_files.dirs(childDir).begin()));
 			++state.second;
 			
-			if (mkdir(m_currentDir.str().c_str(), S_IRWXU | S_IRGRP | S_IXGRP) != 0)
+			if (m_writer)
+			{
+				m_writer->mkdir(m_currentDir.str());
+			}
+			else if (mkdir(m_currentDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP) != 0)
 			{
 				if (errno != EEXIST)
 				{
@@ -328,26 +627,640 @@ void ModCompiler::compile()
 		}
 	}
 	
+	numThreads = m_threads;
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	
+	_resolveBases(jobs, numThreads, prefetcher.get());
+	
+	if (prefetcher)
+	{
+		prefetcher.reset(new Prefetcher(m_files, m_prefetchDistance,
+			[this](FrozenModDir const& dir, FrozenModFile const& file)
+			{ return !isUnitDat(dir.category, m_files.source(file).type); }));
+	}
+	
+	// Files are compiled in parallel, but applied to MASSFILE, MASTERRESOURCEUNITS
+	// and pets in tree order, so output is the same for any number of threads
+	runOrdered(jobs.size(), numThreads, numThreads * JOB_WINDOW_PER_THREAD,
+		[&](size_t i)
+		{
+			if (prefetcher && !isUnitDat(jobs[i]->category, m_files.source(*jobs[i]->file).type))
+				prefetcher->advance();
+			
+			_runJob(*jobs[i]);
+		},
+		[&](size_t i)
+		{
+			_commitFile(*jobs[i]);
+			jobs[i].reset();
+		});
+	
+	m_baseFiles.clear();
+	
+	// Generated files below may replace copied ones
+	if (m_writer)
+	{
+		m_writer->flush();
+		m_writer.reset();
+	}
+	
 	std::cerr << "Generating media/MASSFILE.DAT.ADM" << std::endl;
-	adm::admFileWrite(m_currentDir.build("media/MASSFILE.DAT.ADM"), m_massfile);
+	writeOutput(std::cerr, FileName::build(m_currentDir.str(), "media/MASSFILE.DAT.ADM"), m_massfile);
 	
 	std::cerr << "Generating media/MASTERRESOURCEUNITS.DAT.ADM" << std::endl;
-	adm::admFileWrite(m_currentDir.build("media/MASTERRESOURCEUNITS.DAT.ADM"), m_masterresourceunits);
+	writeOutput(std::cerr, FileName::build(m_currentDir.str(), "media/MASTERRESOURCEUNITS.DAT.ADM"), m_masterresourceunits);
 	
 	if (mergeClasses())
 	{
 		std::cerr << "Generating media/UI/charactercreate.layout" << std::endl;
 		createCharacterCreateLayout();
 	}
+}
+
+void ModCompiler::_resolveBases(std::vector<std::unique_ptr<FileJob>>& jobs, unsigned numThreads,
+                                Prefetcher* prefetcher)
+{
+	using BaseFileEntry = std::pair<FrozenModFile const* const, BaseFile>;
 	
-	std::cerr << std::endl;
-	std::cerr << "Done! Now pack 'media' directory located in " << m_currentDir << " into ZIP archive";
-	std::cerr << " called 'pak.zip' and replace the one in game directory." << std::endl;
-	std::cerr << "Note that this program might contain bugs, don't forget to backup your save files!";
-	std::cerr << std::endl;
+	std::unordered_map<FrozenModFile const*, FileJob*> units;
+	std::vector<BaseFileEntry*> level, nextLevel;
+	std::unordered_map<BaseFile const*, size_t> mergeTasks;
+	TaskGraph loads, merges;
+	FrozenModFile const* file;
+	string baseFn;
+	
+	m_baseFiles.clear();
+	
+	// BASEFILEs of all units have to be known before any of them is compiled,
+	// so units are loaded here instead of by processDat()
+	for (auto& job : jobs)
+	{
+		FileJob* unit = job.get();
+		
+		if (job->replayed != nullptr || !isUnitDat(job->category, m_files.source(*job->file).type))
+			continue;
+		
+		units[unit->file] = unit;
+		
+		// Loads start in tree order, the same order as prefetched
+		loads.add([this, unit, prefetcher]()
+		{
+			if (prefetcher)
+				prefetcher->advance();
+			
+			try {
+				unit->adm = _loadDat(*unit);
+			}
+			catch (...)
+			{
+				unit->error = std::current_exception();
+			}
+		});
+	}
+	
+	loads.run(numThreads);
+	
+	// Returns node of BASEFILE, new nodes are looked at in the next level
+	auto addBase = [&](FrozenModFile const* baseFile, string const& baseRef) -> BaseFile*
+	{
+		auto inserted = m_baseFiles.insert(std::make_pair(baseFile, BaseFile()));
+		BaseFile& base = inserted.first->second;
+		
+		if (inserted.second)
+		{
+			base.path = normalizeBaseFile(baseRef);
+			base.base = nullptr;
+			base.inCycle = false;
+			
+			// Details of failed unit are in its own log
+			auto unit = units.find(baseFile);
+			if (unit != units.end())
+			{
+				base.adm = unit->second->adm;
+				base.error = unit->second->error;
+				
+				if (base.error)
+					base.loadLog = formatLoadError(base.error) + "\n";
+			}
+			
+			nextLevel.push_back(&*inserted.first);
+		}
+		
+		return &base;
+	};
+	
+	// Missing BASEFILEs of units are reported by addToMasterResourceUnits()
+	for (auto& job : jobs)
+	{
+		if (job->adm && !isDontCreate(*job->adm) && getBaseFile(*job->adm, baseFn))
+		{
+			if ((file = m_files.lookupFile(baseFn)) != nullptr)
+				addBase(file, baseFn);
+		}
+	}
+	
+	// Chains are followed one level at a time, bases which aren't units are
+	// loaded in parallel
+	while (!nextLevel.empty())
+	{
+		level.swap(nextLevel);
+		nextLevel.clear();
+		
+		TaskGraph levelLoads;
+		
+		for (BaseFileEntry* entry : level)
+		{
+			if (entry->second.adm || entry->second.error)
+				continue;
+			
+			// Warnings are dropped, the file reports them when it is compiled itself
+			levelLoads.add([this, entry]()
+			{
+				std::ostringstream log;
+				
+				try {
+					entry->second.adm = adm::Adm::createFromFile(m_files.source(*entry->first).path(), log);
+				}
+				catch (...)
+				{
+					entry->second.error = std::current_exception();
+					entry->second.loadLog = log.str() + formatLoadError(entry->second.error) + "\n";
+				}
+			});
+		}
+		
+		levelLoads.run(numThreads);
+		
+		for (BaseFileEntry* entry : level)
+		{
+			BaseFile& base = entry->second;
+			
+			if (!base.adm || !getBaseFile(*base.adm, baseFn))
+				continue;
+			
+			if ((file = m_files.lookupFile(baseFn)) != nullptr)
+				base.base = addBase(file, baseFn);
+			else
+				base.missingBase = baseFn;
+		}
+	}
+	
+	_findBaseCycles();
+	
+	// Each file is merged with its bases as soon as they are merged, files
+	// whose chain is broken are left unmerged
+	for (auto& entry : m_baseFiles)
+	{
+		BaseFile* base = &entry.second;
+		
+		if (!base->adm || !base->missingBase.empty() || base->inCycle)
+			continue;
+		
+		mergeTasks[base] = merges.add([base]()
+		{
+			if (base->base == nullptr)
+			{
+				base->resolved = base->adm;
+			}
+			else if (base->base->resolved)
+			{
+				auto resolved = std::make_shared<adm::Adm>(*base->base->resolved);
+				
+				resolved->mergeNodes(*base->adm, base->adm->root(), resolved->root(), adm::AttributeReplaceMode::ReplaceAtRoot);
+				base->resolved = std::move(resolved);
+			}
+		});
+	}
+	
+	for (auto const& task : mergeTasks)
+	{
+		auto baseTask = mergeTasks.find(task.first->base);
+		
+		if (baseTask != mergeTasks.end())
+			merges.addDependency(task.second, baseTask->second);
+	}
+	
+	merges.run(numThreads);
+}
+
+void ModCompiler::_findBaseCycles()
+{
+	enum { NEW, WALKED, DONE };
+	
+	std::unordered_map<BaseFile*, int> state;
+	std::vector<BaseFile*> chain;
+	BaseFile* base;
+	
+	// Each file has at most one BASEFILE, so a chain which reaches a file
+	// walked by itself runs in a cycle from there
+	for (auto& entry : m_baseFiles)
+	{
+		chain.clear();
+		
+		for (base = &entry.second; base != nullptr && state[base] == NEW; base = base->base)
+		{
+			state[base] = WALKED;
+			chain.push_back(base);
+		}
+		
+		if (base != nullptr && state[base] == WALKED)
+		{
+			for (auto it = std::find(chain.begin(), chain.end(), base); it != chain.end(); ++it)
+				(*it)->inCycle = true;
+		}
+		
+		for (BaseFile* walked : chain)
+			state[walked] = DONE;
+	}
+}
+
+std::shared_ptr<adm::Adm> ModCompiler::_loadDat(FileJob& job)
+{
+	job.log << "Compiling " << job.modPath << std::endl;
+	
+	try {
+		// Warnings follow the "Compiling" line, like when files are compiled one by one
+		return adm::Adm::createFromFile(m_files.source(*job.file).path(), job.log);
+	}
+	catch (adm::DatFileLoader::Exception& e)
+	{
+		job.log << e.format() << std::endl;
+		throw;
+	}
+}
+
+void ModCompiler::_addJob(FrozenModFile const& file, std::vector<std::unique_ptr<FileJob>>& jobs)
+{
+	std::unique_ptr<FileJob> job(new FileJob());
+	size_t size;
+	
+	job->file = &file;
+	job->category = m_currentCategory;
+	job->modDirUpper = m_currentModDirUpper.str();
+	job->replayed = nullptr;
+	
+	size = m_currentModDirUpper.push(file.key);
+	job->modPathUpper = m_currentModDirUpper.str();
+	m_currentModDirUpper.pop(size);
+	
+	if (m_watching)
+	{
+		auto compiled = m_compiledDats.find(job->modPathUpper);
+		
+		// Unchanged file only needs its part of MASSFILE or MASTERRESOURCEUNITS
+		if (m_incremental && m_dirtyFiles.count(job->modPathUpper) == 0)
+		{
+			if (compiled == m_compiledDats.end())
+				return;
+			
+			job->replayed = &compiled->second;
+		}
+		else
+		{
+			if (compiled != m_compiledDats.end())
+				m_compiledDats.erase(compiled);
+			m_failedFiles.erase(job->modPathUpper);
+		}
+	}
+	
+	size = m_currentDir.push(file.name);
+	job->outputPath = m_currentDir.str();
+	m_currentDir.pop(size);
+	
+	size = m_currentModDir.push(file.name);
+	job->modPath = m_currentModDir.str();
+	m_currentModDir.pop(size);
+	
+	jobs.push_back(std::move(job));
+}
+
+void ModCompiler::_runJob(FileJob& job)
+{
+	// Failed to load in _resolveBases()
+	if (job.replayed != nullptr || job.error)
+		return;
+	
+	// Reported by _commitFile(), so that it comes in tree order
+	try {
+		processFile(job);
+	}
+	catch (...)
+	{
+		job.error = std::current_exception();
+	}
+}
+
+void ModCompiler::_commitFile(FileJob& job)
+{
+	CompiledDat const& compiled = job.replayed ? *job.replayed : job.compiled;
+	
+	std::cerr << job.log.str();
+	
+	if (job.error)
+	{
+		if (!m_watching)
+			std::rethrow_exception(job.error);
+		
+		try {
+			std::rethrow_exception(job.error);
+		}
+		catch (std::exception& e)
+		{
+			std::cerr << "ERROR: Failed to compile " << job.modPath << ": " << e.what()
+			          << ", it will be compiled again when mod files change." << std::endl;
+			m_failedFiles.insert(job.modPathUpper);
+		}
+		return;
+	}
+	
+	if (compiled.massFileAdm)
+		m_massfile.addFile(*compiled.massFileAdm, compiled.massFileAdm->root(), job.modPathUpper);
+	
+	if (compiled.unitAdm)
+	{
+		if (job.category == DirCategory::UnitsMonsters)
+			tryAddPet(*job.file, compiled.unitAdm);
+		
+		m_masterresourceunits.addUnit(job.file->key, job.modDirUpper, job.category, *compiled.unitAdm);
+	}
+	
+	if (m_watching && job.replayed == nullptr && (compiled.massFileAdm || compiled.unitAdm))
+		m_compiledDats[job.modPathUpper] = std::move(job.compiled);
+}
+
+
+// ~~ Watch mode ~~
+
+namespace {
+
+// True if sources of file differ from previous ones or if some of them changed on disk
+bool sourcesChanged(
+	FrozenModDirectory::Range<ModSource> prevSources,
+	FrozenModDirectory::Range<ModSource> sources,
+	ModWatcher::ChangedFiles const& changed)
+{
+	if (prevSources.size() != sources.size())
+		return true;
+	
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		ModSource const& prev = prevSources[i];
+		ModSource const& source = sources[i];
+		
+		if (prev.mod != source.mod || prev.dir != source.dir || prev.name != source.name || prev.type != source.type)
+			return true;
+		
+		if (changed.count(std::make_tuple(source.mod, source.dir, source.name)) != 0)
+			return true;
+	}
+	
+	return false;
+}
+
+}
+
+void ModCompiler::watch()
+{
+	using Clock = std::chrono::steady_clock;
+	
+	ModWatcher watcher;
+	ModWatcher::ChangedFiles changed;
+	Clock::time_point start;
+	size_t numCompiled;
+	bool complete;
+	
+	m_watching = true;
+	
+	// Directories are watched before the first compile, so that changes made
+	// during it aren't missed
+	for (string const& modPath : m_modPaths)
+		watcher.addMod(modPath);
+	
+	compile();
+	
+	for (;;)
+	{
+		std::cerr << std::endl << "Watching mod directories for changes, press Ctrl+C to quit." << std::endl;
+		
+		do
+		{
+			changed.clear();
+			complete = watcher.wait(changed);
+			start = Clock::now();
+			
+			try {
+				numCompiled = _update(changed, !complete);
+			}
+			catch (std::exception& e)
+			{
+				std::cerr << "ERROR: " << e.what() << std::endl;
+				numCompiled = 0;
+			}
+		} while (numCompiled == 0);
+		
+		std::cerr << "Compiled " << numCompiled << " changed files in "
+		          << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count()
+		          << " ms." << std::endl;
+	}
 }
 
-void ModCompiler::tryAddPet(ModFileEntry const& entry, std::shared_ptr<adm::Adm> admPtr)
+size_t ModCompiler::_update(ModWatcher::ChangedFiles const& changed, bool compileAll)
+{
+	ModDirectory mods;
+	FrozenModDirectory prev;
+	
+	// With scan cache only changed directories are read again
+	for (string const& modPath : m_modPaths)
+	{
+		try {
+			mods.loadFromDir(modPath, m_scanCacheDir.str());
+		}
+		catch (DirIterator::OpenFailed& e)
+		{
+			std::cerr << "WARNING: Could not load mod " << modPath << ": " << e.what() << std::endl;
+		}
+	}
+	
+	prev = std::move(m_files);
+	m_files = mods.freeze();
+	m_files.buildPathIndex();
+	
+	TreeDiff diff{prev, changed};
+	
+	diff.prevOutputDir.assign(m_outputDir.str());
+	
+	m_dirtyFiles.clear();
+	_diffDir(&prev.root(), &m_files.root(), diff);
+	
+	// Units are compiled with their whole BASEFILE chain merged in
+	for (auto const& entry : m_compiledDats)
+	{
+		for (string const& baseFile : entry.second.baseFiles)
+		{
+			if (m_dirtyFiles.count(baseFile) != 0 || diff.removed.count(baseFile) != 0)
+			{
+				m_dirtyFiles.insert(entry.first);
+				break;
+			}
+		}
+	}
+	
+	if (!compileAll && m_dirtyFiles.empty() && diff.removed.empty())
+		return 0;
+	
+	m_incremental = !compileAll;
+	
+	try {
+		_compileTree();
+	}
+	catch (...)
+	{
+		m_incremental = false;
+		throw;
+	}
+	
+	m_incremental = false;
+	
+	return compileAll ? m_files.numFiles() : m_dirtyFiles.size() + diff.removed.size();
+}
+
+void ModCompiler::_diffDir(FrozenModDir const* prevDir, FrozenModDir const* dir, TreeDiff& diff)
+{
+	using FileRange = FrozenModDirectory::Range<FrozenModFile>;
+	using DirRange  = FrozenModDirectory::Range<FrozenModDir>;
+	
+	FileRange prevFiles = prevDir ? diff.prev.files(*prevDir) : FileRange(nullptr, nullptr);
+	FileRange files = dir ? m_files.files(*dir) : FileRange(nullptr, nullptr);
+	DirRange prevDirs = prevDir ? diff.prev.dirs(*prevDir) : DirRange(nullptr, nullptr);
+	DirRange dirs = dir ? m_files.dirs(*dir) : DirRange(nullptr, nullptr);
+	FrozenModFile const *prevFile = prevFiles.begin(), *file = files.begin();
+	FrozenModDir const *prevChild = prevDirs.begin(), *child = dirs.begin();
+	int cmp;
+	
+	// Entries of both directories are sorted by key, so they are walked side by side
+	while (prevFile != prevFiles.end() || file != files.end())
+	{
+		if (prevFile == prevFiles.end())
+			cmp = 1;
+		else if (file == files.end())
+			cmp = -1;
+		else
+			cmp = prevFile->key.compare(file->key);
+		
+		if (cmp < 0)
+		{
+			_removeOutput(*prevFile++, diff);
+		}
+		else if (cmp > 0)
+		{
+			_markDirty(*file++, diff);
+		}
+		else
+		{
+			// Output file is named differently or is of different kind
+			if (prevFile->name != file->name || diff.prev.source(*prevFile).type != m_files.source(*file).type)
+			{
+				_removeOutput(*prevFile, diff);
+				_markDirty(*file, diff);
+			}
+			else if (sourcesChanged(diff.prev.sources(*prevFile), m_files.sources(*file), diff.changed))
+			{
+				_markDirty(*file, diff);
+			}
+			else if (!m_failedFiles.empty())
+			{
+				size_t size = diff.modDirUpper.push(file->key);
+				if (m_failedFiles.count(diff.modDirUpper.str()) != 0)
+					m_dirtyFiles.insert(diff.modDirUpper.str());
+				diff.modDirUpper.pop(size);
+			}
+			
+			++prevFile;
+			++file;
+		}
+	}
+	
+	while (prevChild != prevDirs.end() || child != dirs.end())
+	{
+		FrozenModDir const *prevSubdir = nullptr, *subdir = nullptr;
+		
+		if (prevChild == prevDirs.end())
+			cmp = 1;
+		else if (child == dirs.end())
+			cmp = -1;
+		else
+			cmp = prevChild->key.compare(child->key);
+		
+		if (cmp <= 0)
+			prevSubdir = prevChild++;
+		if (cmp >= 0)
+			subdir = child++;
+		
+		// Directory with name in different case is different output directory
+		if (prevSubdir != nullptr && subdir != nullptr && prevSubdir->name != subdir->name)
+		{
+			_diffSubdir(prevSubdir, nullptr, diff);
+			_diffSubdir(nullptr, subdir, diff);
+		}
+		else
+		{
+			_diffSubdir(prevSubdir, subdir, diff);
+		}
+	}
+}
+
+void ModCompiler::_diffSubdir(FrozenModDir const* prevDir, FrozenModDir const* dir, TreeDiff& diff)
+{
+	size_t prevOutputSize, modDirSize;
+	
+	prevOutputSize = diff.prevOutputDir.size();
+	
+	if (prevDir != nullptr)
+		diff.prevOutputDir.push(prevDir->name);
+	
+	modDirSize = diff.modDirUpper.push(dir != nullptr ? dir->key : prevDir->key);
+	
+	_diffDir(prevDir, dir, diff);
+	
+	// Output directory of removed directory is removed too, if nothing else is left in it
+	if (dir == nullptr)
+		::rmdir(diff.prevOutputDir.c_str());
+	
+	diff.prevOutputDir.pop(prevOutputSize);
+	diff.modDirUpper.pop(modDirSize);
+}
+
+void ModCompiler::_removeOutput(FrozenModFile const& prevFile, TreeDiff& diff)
+{
+	size_t size;
+	
+	size = diff.prevOutputDir.push(prevFile.name);
+	std::cerr << "Removing " << diff.prevOutputDir << std::endl;
+	
+	// Compiled DATs have ADM next to them
+	::unlink(diff.prevOutputDir.c_str());
+	diff.prevOutputDir.append(".adm");
+	::unlink(diff.prevOutputDir.c_str());
+	diff.prevOutputDir.pop(size);
+	
+	size = diff.modDirUpper.push(prevFile.key);
+	diff.removed.insert(diff.modDirUpper.str());
+	m_compiledDats.erase(diff.modDirUpper.str());
+	m_failedFiles.erase(diff.modDirUpper.str());
+	diff.modDirUpper.pop(size);
+}
+
+void ModCompiler::_markDirty(FrozenModFile const& file, TreeDiff& diff)
+{
+	size_t size;
+	
+	size = diff.modDirUpper.push(file.key);
+	m_dirtyFiles.insert(diff.modDirUpper.str());
+	diff.modDirUpper.pop(size);
+}
+
+void ModCompiler::tryAddPet(FrozenModFile const& file, std::shared_ptr<adm::Adm> admPtr)
 {
 	adm::StringMap& stringMap = admPtr->stringMap();
 	adm::AttributeIterator attr;
@@ -394,71 +1307,85 @@ void ModCompiler::tryAddPet(ModFileEntry const& entry, std::shared_ptr<adm::Adm>
 }
 
 void ModCompiler::addToMasterResourceUnits(
-		ModFileEntry const& entry,
+		FileJob& job,
 		std::shared_ptr<adm::Adm>& admPtr)
 	{
-		stack<std::shared_ptr<adm::Adm>> admStack;
-		adm::AttributeIterator attr;
-		string baseFn;
-		ModFileIterator fileIt;
-		uint32_t DONTCREATE_id, BASEFILE_id;
-		
-		if (admPtr->stringMap().find("DONTCREATE", DONTCREATE_id))
-			attr = admPtr->root().attributes.find(DONTCREATE_id);
-		else
-			attr = admPtr->root().attributes.end();
+		std::shared_ptr<adm::Adm> merged;
+		string baseFn, cycle;
+		FrozenModFile const* baseFile;
+		BaseFile* base;
 		
 		// Skip items marked as DONTCREATE
-		if (attr != admPtr->root().attributes.end() && attr->second.type == adm::AttributeValue::TYPE_BOOL)
-		{
-			if (attr->second.valu32 == 1)
-				return;
-		}
+		if (isDontCreate(*admPtr))
+			return;
 		
-		// Load all basefiles onto admStack
-		for (;;)
+		if (getBaseFile(*admPtr, baseFn))
 		{
-			if (!admPtr->stringMap().find("BASEFILE", BASEFILE_id))
-				break;
-			
-			attr = admPtr->root().attributes.find(BASEFILE_id);
-			
-			if (attr == admPtr->root().attributes.end() || attr->second.type != adm::AttributeValue::TYPE_STRING)
-				break;
-			
-			baseFn = admPtr->getString(attr->second.valu32);
-			FileName::winSlashesToPosix(baseFn);
-			baseFn = utf8_to_upper(baseFn);
-			
-			if (!m_files.lookupFile(baseFn, fileIt))
+			baseFile = m_files.lookupFile(baseFn);
+			if (baseFile == nullptr)
 			{
-				std::cerr << "ERROR: cannot find file " << baseFn 
-				          << " needed by " << m_currentModDir.build(entry.first) << std::endl;
+				job.log << "ERROR: cannot find file " << baseFn 
+				        << " needed by " << job.modPath << std::endl;
 				throw std::runtime_error("Cannot find BASEFILE");
 			}
 			
-			admStack.push(admPtr);
-			admPtr = adm::Adm::createFromFile(fileIt->second.front());
+			// Whole chain was loaded and merged by _resolveBases(), only errors
+			// on the way are reported here
+			for (base = &m_baseFiles.at(baseFile); ; base = base->base)
+			{
+				job.compiled.baseFiles.push_back(base->path);
+				
+				if (base->error)
+				{
+					job.log << "ERROR: cannot load BASEFILE " << base->path
+					        << " needed by " << job.modPath << std::endl << base->loadLog;
+					std::rethrow_exception(base->error);
+				}
+				
+				if (!base->missingBase.empty())
+				{
+					job.log << "ERROR: cannot find file " << base->missingBase 
+					        << " needed by " << job.modPath << std::endl;
+					throw std::runtime_error("Cannot find BASEFILE");
+				}
+				
+				if (base->inCycle)
+				{
+					cycle = base->path;
+					for (BaseFile* next = base->base; ; next = next->base)
+					{
+						cycle += " -> " + next->path;
+						if (next == base)
+							break;
+					}
+					
+					job.log << "ERROR: BASEFILE chain of " << job.modPath << " runs in a cycle: "
+					        << cycle << std::endl;
+					throw std::runtime_error("BASEFILE cycle");
+				}
+				
+				if (base->base == nullptr)
+					break;
+			}
+			
+			merged = std::make_shared<adm::Adm>(*m_baseFiles.at(baseFile).resolved);
+			merged->mergeNodes(*admPtr, admPtr->root(), merged->root(), adm::AttributeReplaceMode::ReplaceAtRoot);
+			admPtr = merged;
 		}
-		
-		// Merge them
-		while (!admStack.empty())
+		else if (m_baseFiles.count(job.file) != 0)
 		{
-			std::shared_ptr<adm::Adm>& top = admStack.top();
-			
-			admPtr->mergeNodes(*top, top->root(), admPtr->root(), adm::AttributeReplaceMode::ReplaceAtRoot);
-			admStack.pop();
+			// Other units are based on it, so it is shared with them
+			admPtr = std::make_shared<adm::Adm>(*admPtr);
 		}
 		
-		if (m_currentModDirUpper.isChildOf("MEDIA/UNITS/ITEMS"))
-			tryMergeClassWardrobes(entry, admPtr);
-		else if (m_currentModDirUpper.isChildOf("MEDIA/UNITS/MONSTERS"))
-			tryAddPet(entry, admPtr);
+		if (job.category == DirCategory::UnitsItems)
+			tryMergeClassWardrobes(job.log, *job.file, admPtr);
 		
-		m_masterresourceunits.addUnit(utf8_to_upper(entry.first), m_currentModDirUpper, *admPtr);
+		// Pets and MASTERRESOURCEUNITS are filled by _commitFile()
+		job.compiled.unitAdm = admPtr;
 	}
 
-void ModCompiler::tryMergeClassWardrobes(ModFileEntry const& entry, std::shared_ptr<adm::Adm> admPtr)
+void ModCompiler::tryMergeClassWardrobes(std::ostream& log, FrozenModFile const& file, std::shared_ptr<adm::Adm> admPtr)
 {
 	struct AdmStringInfo
 	{
@@ -513,11 +1440,11 @@ void ModCompiler::tryMergeClassWardrobes(ModFileEntry const& entry, std::shared_
 	
 	// Merge wardrobes from previous mods
 	{
-		std::list<string>::const_iterator fileIt, fileItEnd;
+		ModSource const *fileIt, *fileItEnd;
 		uint32_t WARDROBE_id, CLASS_id;
 		
-		fileIt = entry.second.begin();
-		fileItEnd = entry.second.end();
+		fileIt = m_files.sources(file).begin();
+		fileItEnd = m_files.sources(file).end();
 		
 		// Skipping first entry since it is admPtr
 		while (++fileIt != fileItEnd)
@@ -525,7 +1452,7 @@ void ModCompiler::tryMergeClassWardrobes(ModFileEntry const& entry, std::shared_
 			adm::Adm prevAdm;
 			
 			try {
-				prevAdm.loadFromFile(*fileIt);
+				prevAdm.loadFromFile(fileIt->path(), log);
 			}
 			catch (...)
 			{ continue; }
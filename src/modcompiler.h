@@ -10,26 +10,50 @@
 #define __TLMODDER_MODCOMPILER_H__
 
 #include "adm.h"
+#include "filename_utils.h"
 #include "massfile.h"
 #include "masterresourceunits.h"
 #include "moddirectory.h"
+#include "modwatcher.h"
+#include "output_writer.h"
 
+#include <exception>
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace tlmodder {
 
 using std::map;
 using std::string;
 
+class Prefetcher;
+
 class ModCompiler
 {
 public:
-	ModCompiler()
+	ModCompiler():
+		m_isFrozen(false),
+		m_watching(false),
+		m_incremental(false),
+		m_currentCategory(DirCategory::Root),
+		m_prefetchDistance(0),
+		m_ioUring(false),
+		m_preserveAttributes(false),
+		m_linkAssets(false),
+		m_threads(0),
+		m_numWritten(0),
+		m_numUnchanged(0)
 	{}
 	
 	void addMod(ModDirectory&& mod);
+	
+	// Mods added by path can be watched for changes, see watch()
 	void addMod(std::string const& modPath);
 	
 	struct ExtInfo
@@ -43,6 +67,18 @@ public:
 	
 	void compile();
 	
+	// Compiles all mods and then keeps recompiling whenever files in directories
+	// of mods added by path change, never returns
+	// Only files whose sources changed are compiled again, together with units
+	// whose BASEFILE chain contains them. MASSFILE.DAT.ADM and
+	// MASTERRESOURCEUNITS.DAT.ADM are rebuilt from results of earlier compiles
+	// kept in memory. Errors in single files don't stop watching, the files are
+	// compiled again on next change.
+	void watch();
+	
+	// Merged tree of all added mods, no more mods can be added once this is called
+	FrozenModDirectory const& files();
+	
 	bool mergeClasses() const
 	{ return m_mergeClasses; }
 	
@@ -55,29 +91,180 @@ public:
 	void outputDir(FileName fn)
 	{ m_outputDir = std::move(fn); }
 	
+	// Directory with scan snapshots used by addMod(), empty to always scan mods from scratch
+	FileName const& scanCacheDir() const
+	{ return m_scanCacheDir; }
+	
+	void scanCacheDir(FileName fn)
+	{ m_scanCacheDir = std::move(fn); }
+	
+	// Number of files whose reading is started ahead of compiling them, 0 to disable
+	unsigned prefetchDistance() const
+	{ return m_prefetchDistance; }
+	
+	void prefetchDistance(unsigned distance)
+	{ m_prefetchDistance = distance; }
+	
+	// Output is written through io_uring if the kernel supports it, not while watching
+	bool ioUring() const
+	{ return m_ioUring; }
+	
+	void ioUring(bool use)
+	{ m_ioUring = use; }
+	
+	// Copied files get permissions and times of their sources
+	bool preserveAttributes() const
+	{ return m_preserveAttributes; }
+	
+	void preserveAttributes(bool preserve)
+	{ m_preserveAttributes = preserve; }
+	
+	// Files which are only copied are hard linked into output directory
+	// instead, or symlinked if that is not possible. Copied if neither works.
+	bool linkAssets() const
+	{ return m_linkAssets; }
+	
+	void linkAssets(bool link)
+	{ m_linkAssets = link; }
+	
+	// Number of threads compiling files, 0 means number of CPUs
+	// Output doesn't depend on it, see _compileTree().
+	unsigned threads() const
+	{ return m_threads; }
+	
+	void threads(unsigned numThreads)
+	{ m_threads = numThreads; }
+	
 protected:
-	void copyFile(string const& src, string const& dst);
-	void processDat(ModFileEntry const& entry, ExtInfo const& extInfo);
+	// Result of compiling DAT file, kept while watching
+	struct CompiledDat
+	{
+		std::shared_ptr<adm::Adm> massFileAdm;  // added to MASSFILE
+		std::shared_ptr<adm::Adm> unitAdm;      // added to MASTERRESOURCEUNITS, with bases merged
+		std::vector<string> baseFiles;          // upper-cased in-mod paths of its BASEFILE chain
+	};
+	
+	// File being compiled by one of the threads of _compileTree()
+	// processFile() fills it without touching shared state except for output
+	// bookkeeping, _commitFile() applies it in tree order.
+	struct FileJob
+	{
+		FrozenModFile const* file;
+		DirCategory category;     // category of its directory
+		string outputPath;        // output file
+		string modPath;           // in-mod path, as it is printed
+		string modDirUpper;       // upper-cased in-mod directory
+		string modPathUpper;      // upper-cased in-mod path
+		CompiledDat const* replayed;  // not compiled, result of previous compile is applied instead
+		
+		std::ostringstream log;   // printed when committed, so messages stay in tree order
+		std::shared_ptr<adm::Adm> adm;  // source of unit, loaded ahead by _resolveBases()
+		CompiledDat compiled;
+		std::exception_ptr error;
+	};
+	
+	// File which some unit uses as BASEFILE, see _resolveBases()
+	struct BaseFile
+	{
+		string path;                          // upper-cased in-mod path
+		std::shared_ptr<adm::Adm> adm;        // as loaded, shared with its FileJob
+		BaseFile* base;                       // its own BASEFILE, if it has one
+		string missingBase;                   // its BASEFILE if that doesn't exist
+		bool inCycle;                         // part of BASEFILE cycle
+		std::exception_ptr error;             // loading failed
+		string loadLog;                       // messages of loading, only kept when it failed
+		std::shared_ptr<adm::Adm> resolved;   // merged with all its bases, never changed
+	};
+	
+	// State of comparison of previous and current tree, see _diffDir()
+	struct TreeDiff
+	{
+		FrozenModDirectory const& prev;
+		ModWatcher::ChangedFiles const& changed;
+		PathBuilder prevOutputDir;      // output directory of directory in previous tree
+		PathBuilder modDirUpper;        // upper-cased in-mod directory
+		std::unordered_set<string> removed;
+	};
+	
+	// Following functions may be called from multiple threads, failures are
+	// described in log
+	void copyFile(std::ostream& log, string const& src, string const& dst);
+	void linkOrCopyFile(std::ostream& log, string const& src, string const& dst);
+	
+	// Output files are only written if their contents differ
+	void writeOutput(std::ostream& log, string const& path, string&& data);
+	void writeOutput(std::ostream& log, string const& path, adm::Adm const& adm);
+	void processDat(FileJob& job, ExtInfo const& extInfo);
 	void loadClasses();
-	void tryAddPet(ModFileEntry const& entry, std::shared_ptr<adm::Adm> admPtr);
+	void tryAddPet(FrozenModFile const& file, std::shared_ptr<adm::Adm> admPtr);
 	void createCharacterCreateLayout();
-	void processFile(ModFileEntry const& entry);
-	void tryMergeClassWardrobes(ModFileEntry const& entry, std::shared_ptr<adm::Adm> admPtr);
-	void addToMasterResourceUnits(ModFileEntry const& entry, std::shared_ptr<adm::Adm>& admPtr);
+	void processFile(FileJob& job);
+	void tryMergeClassWardrobes(std::ostream& log, FrozenModFile const& file, std::shared_ptr<adm::Adm> admPtr);
+	void addToMasterResourceUnits(FileJob& job, std::shared_ptr<adm::Adm>& admPtr);
+	
+	void _compileTree();
+	
+	// Loads sources of units and every file in their BASEFILE chains, and
+	// merges each of those files with its bases once
+	void _resolveBases(std::vector<std::unique_ptr<FileJob>>& jobs, unsigned numThreads, Prefetcher* prefetcher);
+	void _findBaseCycles();
+	std::shared_ptr<adm::Adm> _loadDat(FileJob& job);
+	
+	// Adds job for file in current directories, unless it can be skipped
+	void _addJob(FrozenModFile const& file, std::vector<std::unique_ptr<FileJob>>& jobs);
+	void _runJob(FileJob& job);
+	void _commitFile(FileJob& job);
+	
+	// Files in output directory which weren't produced by the last compile
+	size_t _countStale(string const& dir) const;
+	
+	// Rescans watched mods and compiles what changed, returns number of compiled files
+	size_t _update(ModWatcher::ChangedFiles const& changed, bool compileAll);
+	void _diffDir(FrozenModDir const* prevDir, FrozenModDir const* dir, TreeDiff& diff);
+	void _diffSubdir(FrozenModDir const* prevDir, FrozenModDir const* dir, TreeDiff& diff);
+	void _removeOutput(FrozenModFile const& prevFile, TreeDiff& diff);
+	void _markDirty(FrozenModFile const& file, TreeDiff& diff);
 	
 	MassFile m_massfile;
 	MasterResourceUnits m_masterresourceunits;
-	ModDirectory m_files;
+	ModDirectory m_mods;              // mods merged so far, emptied when frozen
+	FrozenModDirectory m_files;
+	bool m_isFrozen;
+	
+	std::vector<string> m_modPaths;   // mods added by path, in order they were added
+	bool m_watching;
+	bool m_incremental;               // only files in m_dirtyFiles are compiled
+	std::unordered_map<string, CompiledDat> m_compiledDats;  // by upper-cased in-mod path
+	std::unordered_set<string> m_dirtyFiles;
+	std::unordered_set<string> m_failedFiles;
 	
 	map<string, string> m_classes;
 	map<string, string> m_pets;
 	
-	FileName m_currentDir;         // Current filesystem directory
-	FileName m_currentModDir;      // Current in-mod directory
-	FileName m_currentModDirUpper; // Current in-mod directory in upper-case
+	// Current directories while the tree is walked by _compileTree()
+	PathBuilder m_currentDir;         // Current filesystem directory
+	PathBuilder m_currentModDir;      // Current in-mod directory
+	PathBuilder m_currentModDirUpper; // Current in-mod directory in upper-case
+	DirCategory m_currentCategory;    // Category of current in-mod directory
 	
 	bool m_mergeClasses;
 	FileName m_outputDir;
+	FileName m_scanCacheDir;
+	unsigned m_prefetchDistance;
+	bool m_ioUring;
+	bool m_preserveAttributes;
+	bool m_linkAssets;
+	string m_workDir;                 // for absolute link targets, set while linking assets
+	unsigned m_threads;
+	
+	std::mutex m_outputMutex;         // guards following members while compiling
+	std::unordered_set<string> m_outputFiles;   // produced by the last compile
+	size_t m_numWritten;
+	size_t m_numUnchanged;
+	
+	std::unique_ptr<OutputWriter> m_writer;   // only during compile with io_uring, thread-safe
+	
+	std::unordered_map<FrozenModFile const*, BaseFile> m_baseFiles;  // only during compile
 };
 
 }
@@ -9,39 +9,118 @@
 #include "moddirectory.h"
 #include "filename_utils.h"
 #include "dir_iterator.h"
+#include "scan_cache.h"
 #include "unicode.h"
 
-#include <cctype>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 #include <vector>
 #include <stack>
 #include <tuple>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <memory>
+#include <exception>
+#include <unordered_map>
 
 namespace tlmodder {
 
 using std::vector;
 using std::stack;
-using std::list;
 
-// FIXME: ASCII only, should be UTF-8
-bool StringLessNoCase::operator()(string const& str1, string const& str2)
+
+// ~~ Interned source paths ~~
+
+namespace {
+
+struct InternTable
+{
+	std::mutex mutex;
+	std::unordered_map<string, uint32_t> ids;
+	vector<string const*> strings;    // keys of ids, which are never moved
+};
+
+InternTable& internTable()
+{
+	static InternTable table;
+	return table;
+}
+
+}
+
+uint32_t internPath(StringRef str)
 {
-	string::size_type size1, size2, cmpSize, i;
-	int diff;
+	InternTable& table = internTable();
+	std::lock_guard<std::mutex> lock(table.mutex);
 	
-	size1 = str1.size();
-	size2 = str2.size();
-	cmpSize = size1 < size2 ? size1 : size2;
+	auto result = table.ids.insert(std::make_pair(str.str(), (uint32_t)table.strings.size()));
 	
-	for (i = 0; i < cmpSize; ++i)
-	{
-		diff = std::toupper(str1[i]) - std::toupper(str2[i]);
-		if (diff != 0)
-			return diff < 0;
-	}
+	if (result.second)
+		table.strings.push_back(&result.first->first);
+	
+	return result.first->second;
+}
+
+string const& internedPath(uint32_t id)
+{
+	InternTable& table = internTable();
+	std::lock_guard<std::mutex> lock(table.mutex);
 	
-	return size1 < size2;
+	return *table.strings[id];
+}
+
+string ModSource::path() const
+{
+	string result = internedPath(mod);
+	
+	FileName::buildInplace(result, internedPath(dir));
+	FileName::buildInplace(result, internedPath(name));
+	
+	return result;
+}
+
+string const& ModSource::fileName() const
+{
+	return internedPath(name);
+}
+
+
+namespace {
+
+inline bool extensionIs(StringRef ext, char const* upperExt)
+{
+	return utf8_compare_nocase(ext.data(), ext.size(), upperExt, std::strlen(upperExt)) == 0;
+}
+
+FileType fileType(StringRef fn)
+{
+	StringRef ext = FileName::extensionRef(fn);
+	bool isAdm = extensionIs(ext, "ADM");
+	
+	// Type of ADM file is decided by the extension before ".adm"
+	if (isAdm)
+		ext = FileName::extensionRef(fn.substr(0, fn.size() - ext.size() - 1));
+	
+	if (extensionIs(ext, "DAT"))
+		return isAdm ? FileType::DatAdm : FileType::Dat;
+	else if (extensionIs(ext, "ANIMATION"))
+		return isAdm ? FileType::AnimationAdm : FileType::Animation;
+	else if (extensionIs(ext, "LAYOUT"))
+		return isAdm ? FileType::LayoutAdm : FileType::Layout;
+	
+	return FileType::Asset;
+}
+
+}
+
+
+bool StringLessNoCase::operator()(string const& str1, string const& str2) const
+{
+	return utf8_compare_nocase(str1.data(), str1.size(), str2.data(), str2.size()) < 0;
 }
 
 bool ModDirectory::lookupDir(string const& name, ModDirectoryIterator& it)
@@ -115,167 +194,352 @@ bool ModDirectory::lookupFile(string const& name, ModFileIterator& it)
 	throw std::runtime_error("not reached");
 }
 
-void ModDirectory::loadFromDir(string const& modPath)
+namespace {
+
+// Scans mod directory with multiple threads
+// Each worker takes a directory from the queue, reads its files and adds
+// its subdirectories to the tree and to the queue. Every directory node is
+// filled only by the worker which scans it. Directories which differ only in
+// case map to the same node, so all but the first are scanned into detached
+// nodes, which are merged into the tree when the scan is done.
+// With scan cache, listings of unchanged directories are taken from it.
+class DirScanner
 {
-	struct DirectoryLoadState
+public:
+	DirScanner(string const& modPath, ScanCache* cache):
+		m_modPath(modPath),
+		m_modId(internPath(modPath)),
+		m_cache(cache),
+		m_pending(0)
+	{}
+	
+	void run(ModDirectory& root, unsigned numThreads);
+protected:
+	struct Task
 	{
-		ModDirectory *modDir;
-		vector<string> dirs;
-		vector<string>::const_iterator dirIter;
-		
-		DirectoryLoadState(ModDirectory *dir): modDir(dir)
-		{
-			dirIter = dirs.begin();
-		}
+		ModDirectory* modDir;
+		string relativeDir;           // on-disk path relative to mod root
+		unsigned depth;
 	};
 	
-	stack<DirectoryLoadState> loadStateStack;
+	struct DetachedDir
+	{
+		ModDirectory* target;         // node the directory is merged into
+		std::unique_ptr<ModDirectory> modDir;
+		string relativeDir;
+		unsigned depth;
+	};
 	
-	loadStateStack.emplace(this);
+	void _worker();
+	void _scan(Task const& task);
 	
+	// Warns about entries of detached directory which will replace entries of
+	// different kind in its target, the same way as when they are scanned
+	void _warnConflicts(ModDirectory const& target, ModDirectory const& src,
+	                    string const& relativeDir, string const& modDir);
+protected:
+	string m_modPath;
+	uint32_t m_modId;
+	ScanCache* m_cache;
 	
-	FileName currentDir(modPath), currentModDir;
-	string fileName, fileNameUpper;
-	struct stat st;
-	ModDirectory *modDir;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Task> m_queue;
+	size_t m_pending;                 // tasks queued or being scanned
+	std::exception_ptr m_error;
+	
+	vector<DetachedDir> m_detached;
+	vector<std::pair<string, string>> m_warnings; // directory, message
+};
+
+void DirScanner::run(ModDirectory& root, unsigned numThreads)
+{
+	vector<std::thread> workers;
+	
+	m_queue.push_back(Task{&root, string(), 0});
+	m_pending = 1;
+	
+	for (unsigned i = 1; i < numThreads; ++i)
+		workers.emplace_back(&DirScanner::_worker, this);
+	
+	_worker();
+	
+	for (std::thread& thread : workers)
+		thread.join();
+	
+	// Warnings are printed in order of directories, not in order they were found
+	std::stable_sort(m_warnings.begin(), m_warnings.end(),
+		[](std::pair<string, string> const& w1, std::pair<string, string> const& w2)
+		{ return w1.first < w2.first; });
 	
+	for (auto const& warning : m_warnings)
+		std::cerr << warning.second << std::endl;
 	
-	while (!loadStateStack.empty())
+	if (m_error)
+		std::rethrow_exception(m_error);
+	
+	// Nested detached directories go first, so that each is complete when merged
+	std::sort(m_detached.begin(), m_detached.end(), [](DetachedDir const& dir1, DetachedDir const& dir2)
+	{
+		return dir1.depth > dir2.depth || (dir1.depth == dir2.depth && dir1.relativeDir < dir2.relativeDir);
+	});
+	
+	for (DetachedDir& dir : m_detached)
 	{
-		DirectoryLoadState& loadState = loadStateStack.top();
-		modDir = loadState.modDir;
+		// In-mod path starts with lower-case media instead of its on-disk name
+		string::size_type slashPos = dir.relativeDir.find('/');
+		string modDir = "media";
 		
-		if (loadState.dirIter == loadState.dirs.begin())
+		if (slashPos != string::npos)
+			modDir.append(dir.relativeDir, slashPos, string::npos);
+		
+		_warnConflicts(*dir.target, *dir.modDir, dir.relativeDir, modDir);
+		dir.target->merge(std::move(*dir.modDir));
+	}
+}
+
+void DirScanner::_warnConflicts(ModDirectory const& target, ModDirectory const& src,
+                                string const& relativeDir, string const& modDir)
+{
+	string currentDir = FileName::build(m_modPath, relativeDir);
+	
+	for (auto const& srcFile : src.files)
+	{
+		auto it = target.dirs.find(srcFile.first);
+		
+		if (it != target.dirs.end())
 		{
-			DirIterator dir(currentDir.str());
-			
-			while (dir.next(fileName))
-			{
-				// Ignore the file if we cannot stat it
-				if (!dir.stat(fileName, st, false))
-					continue;
-				
-				if (S_ISREG(st.st_mode))
-				{
-					// Ignore all root-level files
-					if (loadStateStack.size() == 1)
-						continue;
-					
-					// Convert name to upper-case
-					fileNameUpper = utf8_to_upper(fileName);
-					
-					// Ignore massfile.dat and masterresourceunits.dat in media directory
-					if (loadStateStack.size() == 2)
-					{
-						if (fileNameUpper == "MASSFILE.DAT" || fileNameUpper == "MASTERRESOURCEUNITS.DAT" ||
-								fileNameUpper == "MASSFILE.DAT.ADM" || fileNameUpper == "MASTERRESOURCEUNITS.DAT.ADM")
-							continue;
-					}
-					
-					// If directory with the same name exists, issue warning and skip it
-					{
-						ModDirectoryIterator it = modDir->dirs.find(fileNameUpper);
-						if (it != modDir->dirs.end())
-						{
-							std::cerr << "WARNING: file \"" << currentDir.build(fileName)
-												<< "\" conflicts with directory \""
-												<< currentModDir.build(it->first) << ", replacing." << std::endl;
-							modDir->dirs.erase(it);
-						}
-					}
-					
-					string sourceFn = fileName;
-					string ext = FileName::extension(fileNameUpper);
-					
-					bool isDat;
-					bool isAdm = (ext == "ADM");
-					
-					if (isAdm)
-					{
-						FileName::stripExtInplace(sourceFn);
-						ext = utf8_to_upper(FileName::extension(sourceFn));
-					}
-					isDat = (ext == "DAT" || ext == "ANIMATION" || ext == "LAYOUT");
-					
-					ModFileIterator it;
-					std::tie(it, std::ignore) = modDir->files.insert(std::make_pair(sourceFn, std::list<string>()));
-					
-					if ((isAdm || isDat) && !it->second.empty())
-					{
-						if (FileName::parent(it->second.front()) == currentDir.str())
-						{
-							if (isDat)
-								it->second.front() = currentDir.build(fileName);
-						}
-						else
-						{
-							it->second.push_front(currentDir.build(fileName));
-						}
-					}
-					else
-					{
-						it->second.push_front(currentDir.build(fileName));
-					}
-				}
-				else if (S_ISDIR(st.st_mode))
-				{
-					loadState.dirs.push_back(fileName);
-				}
-			}
-			loadState.dirIter = loadState.dirs.begin();
+			std::cerr << "WARNING: file \"" << srcFile.second.front().path()
+			          << "\" conflicts with directory \""
+			          << FileName::build(modDir, it->first) << ", replacing." << std::endl;
 		}
+	}
+	
+	for (auto const& srcDir : src.dirs)
+	{
+		auto fileIt = target.files.find(srcDir.first);
+		auto dirIt = target.dirs.find(srcDir.first);
 		
-		if (loadState.dirIter != loadState.dirs.end())
+		if (fileIt != target.files.end())
 		{
-			string const& fn = *loadState.dirIter;
-			++loadState.dirIter;
+			std::cerr << "WARNING: directory \"" << FileName::build(currentDir, srcDir.first)
+			          << "\" conflicts with file \""
+			          << fileIt->second.front().path() << ", replacing." << std::endl;
+		}
+		else if (dirIt != target.dirs.end())
+		{
+			_warnConflicts(dirIt->second, srcDir.second, FileName::build(relativeDir, srcDir.first),
+			               FileName::build(modDir, srcDir.first));
+		}
+	}
+}
+
+void DirScanner::_worker()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	for (;;)
+	{
+		while (m_queue.empty() && m_pending != 0)
+			m_cond.wait(lock);
+		
+		if (m_queue.empty())
+			return;
+		
+		Task task = std::move(m_queue.front());
+		bool failed = (bool)m_error;
+		m_queue.pop_front();
+		
+		lock.unlock();
+		
+		// After a failure remaining tasks are only drained
+		try {
+			if (!failed)
+				_scan(task);
+		}
+		catch (...)
+		{
+			lock.lock();
+			if (!m_error)
+				m_error = std::current_exception();
+			lock.unlock();
+		}
+		
+		lock.lock();
+		
+		if (--m_pending == 0)
+			m_cond.notify_all();
+	}
+}
+
+void DirScanner::_scan(Task const& task)
+{
+	FileName currentDir(m_modPath);
+	string fileName, fileNameUpper;
+	vector<string> dirs;
+	vector<Task> children;
+	DirIterator::EntryType type;
+	ModDirectory& modDir = *task.modDir;
+	ModSource source;
+	ScanCache::Listing listing;
+	struct stat st;
+	bool haveStat;
+	
+	if (!task.relativeDir.empty())
+		currentDir.cd(task.relativeDir);
+	
+	source.mod = m_modId;
+	source.dir = internPath(task.relativeDir);
+	
+	// Directory is stat'ed before it is read, so that change made while it is
+	// being read makes the cached listing outdated
+	haveStat = (m_cache != nullptr && ::stat(currentDir.str().c_str(), &st) == 0);
+	
+	if (!haveStat || !m_cache->find(task.relativeDir, st, listing))
+	{
+		DirIterator dir(currentDir.str());
+		
+		while (dir.next(fileName, type))
+			listing.add(fileName, type);
+	}
+	
+	while (listing.next(fileName, type))
+	{
+		if (type == DirIterator::TYPE_FILE)
+		{
+			// Ignore all root-level files
+			if (task.depth == 0)
+				continue;
 			
 			// Convert name to upper-case
-			fileNameUpper = utf8_to_upper(fn);
-			
-			// Ignore all root-level non-media directories
-			if (loadStateStack.size() == 1 && fileNameUpper != "MEDIA")
-				continue;
+			utf8_to_upper(fileName.data(), fileName.size(), fileNameUpper);
 			
-			// If file with the same name exists, remove it and issue warning
+			// Ignore massfile.dat and masterresourceunits.dat in media directory
+			if (task.depth == 1)
 			{
-				ModFileIterator it = modDir->files.find(fileNameUpper);
-				if (it != modDir->files.end())
-				{
-					std::cerr << "WARNING: directory \"" << currentDir.build(fn)
-					          << "\" conflicts with file \""
-					          << currentModDir.build(it->second.front()) << ", replacing." << std::endl;
-					modDir->files.erase(it);
-				}
+				if (fileNameUpper == "MASSFILE.DAT" || fileNameUpper == "MASTERRESOURCEUNITS.DAT" ||
+						fileNameUpper == "MASSFILE.DAT.ADM" || fileNameUpper == "MASTERRESOURCEUNITS.DAT.ADM")
+					continue;
 			}
 			
-			ModDirectoryIterator it;
+			string sourceFn = fileName;
+			bool isAdm = (FileName::extensionRef(fileNameUpper) == "ADM");
 			
-			// Make sure media directory is always lower-case, or Torchlight won't find textures
-			string modDirName;
-			if (loadStateStack.size() == 1)
-				modDirName = "media";
-			else
-				modDirName = fn;
+			source.type = fileType(fileName);
+			
+			// In-mod name of compiled file is without ".adm"
+			if (isAdm)
+				FileName::stripExtInplace(sourceFn);
+			
+			ModFileIterator it;
+			std::tie(it, std::ignore) = modDir.files.insert(std::make_pair(sourceFn, ModSourceList()));
 			
-			std::tie(it, std::ignore) = modDir->dirs.insert(std::make_pair(modDirName, ModDirectory()));
+			source.name = internPath(fileName);
 			
-			loadStateStack.emplace(&it->second);
-			currentDir.cd(fn);
-			currentModDir.cd(modDirName);
+			// Only one of DAT and its ADM from the same directory is kept
+			if ((isAdm || isDatFileType(source.type)) && !it->second.empty() &&
+			    it->second.front().mod == source.mod && it->second.front().dir == source.dir)
+			{
+				if (isDatFileType(source.type))
+					it->second.front() = source;
+			}
+			else
+			{
+				it->second.insert(it->second.begin(), &source, &source + 1);
+			}
 		}
-		else
+		else if (type == DirIterator::TYPE_DIR)
 		{
-			// No more entries in current directory, go one level up
-			loadStateStack.pop();
-			
-			if (!loadStateStack.empty())
+			dirs.push_back(fileName);
+		}
+	}
+	
+	for (string const& fn : dirs)
+	{
+		// Convert name to upper-case
+		utf8_to_upper(fn.data(), fn.size(), fileNameUpper);
+		
+		// Ignore all root-level non-media directories
+		if (task.depth == 0 && fileNameUpper != "MEDIA")
+			continue;
+		
+		// If file with the same name exists, remove it and issue warning
+		{
+			ModFileIterator it = modDir.files.find(fileNameUpper);
+			if (it != modDir.files.end())
 			{
-				currentDir.up();
-				currentModDir.up();
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_warnings.push_back(std::make_pair(task.relativeDir,
+					"WARNING: directory \"" + currentDir.build(fn) + "\" conflicts with file \"" +
+					it->second.front().path() + ", replacing."));
+				modDir.files.erase(it);
 			}
 		}
+		
+		ModDirectoryIterator it;
+		bool inserted;
+		
+		// Make sure media directory is always lower-case, or Torchlight won't find textures
+		string modDirName;
+		if (task.depth == 0)
+			modDirName = "media";
+		else
+			modDirName = fn;
+		
+		std::tie(it, inserted) = modDir.dirs.insert(std::make_pair(modDirName, ModDirectory()));
+		
+		Task child{&it->second, FileName::build(task.relativeDir, fn), task.depth + 1};
+		
+		if (!inserted)
+		{
+			std::unique_ptr<ModDirectory> detached(new ModDirectory());
+			child.modDir = detached.get();
+			
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_detached.push_back(DetachedDir{&it->second, std::move(detached), child.relativeDir, child.depth});
+		}
+		
+		children.push_back(std::move(child));
 	}
+	
+	if (haveStat)
+		m_cache->store(task.relativeDir, st, std::move(listing));
+	
+	if (!children.empty())
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		
+		for (Task& child : children)
+			m_queue.push_back(std::move(child));
+		m_pending += children.size();
+		m_cond.notify_all();
+	}
+}
+
+}
+
+void ModDirectory::loadFromDir(string const& modPath, string const& cacheDir, unsigned numThreads)
+{
+	ModDirectory loaded;
+	std::unique_ptr<ScanCache> cache;
+	
+	if (!cacheDir.empty())
+		cache.reset(new ScanCache(cacheDir, modPath));
+	
+	DirScanner scanner(modPath, cache.get());
+	
+	if (numThreads == 0)
+		numThreads = std::max(4u, std::thread::hardware_concurrency());
+	
+	scanner.run(loaded, numThreads);
+	
+	if (cache)
+		cache->save();
+	
+	if (files.empty() && dirs.empty())
+		*this = std::move(loaded);
+	else
+		merge(std::move(loaded));
 }
 
 void ModDirectory::merge(ModDirectory&& srcDir)
@@ -289,6 +553,7 @@ void ModDirectory::merge(ModDirectory&& srcDir)
 	ModDirectory *dst, *src;
 	ModDirectoryIterator dirIt;
 	ModFileIterator fileIt;
+	bool inserted;
 	
 	dstStack.emplace(this);
 	srcStack.emplace(&srcDir, srcDir.dirs.begin());
@@ -309,8 +574,12 @@ void ModDirectory::merge(ModDirectory&& srcDir)
 				if (dirIt != dst->dirs.end())
 					dst->dirs.erase(dirIt);
 				
-				std::tie(fileIt, std::ignore) = dst->files.insert(std::make_pair(srcFile.first, list<string>()));
-				fileIt->second.splice(fileIt->second.begin(), std::move(srcFile.second));
+				std::tie(fileIt, inserted) = dst->files.insert(std::make_pair(srcFile.first, ModSourceList()));
+				
+				if (inserted)
+					fileIt->second = std::move(srcFile.second);
+				else
+					fileIt->second.insert(fileIt->second.begin(), srcFile.second.begin(), srcFile.second.end());
 			}
 		}
 		
@@ -324,12 +593,20 @@ void ModDirectory::merge(ModDirectory&& srcDir)
 				dst->files.erase(fileIt);
 			
 			// create directory or use existing
-			std::tie(dirIt, std::ignore) = dst->dirs.insert(std::make_pair(childEntry.first, ModDirectory()));
-			
-			// place child directories onto stacks to merge them
-			srcStack.emplace(&childEntry.second, childEntry.second.dirs.begin());
-			dstStack.emplace(&dirIt->second);
+			std::tie(dirIt, inserted) = dst->dirs.insert(std::make_pair(childEntry.first, ModDirectory()));
 			++srcState.second;
+			
+			if (inserted)
+			{
+				// new directory, whole subtree is taken as it is
+				dirIt->second = std::move(childEntry.second);
+			}
+			else
+			{
+				// place child directories onto stacks to merge them
+				srcStack.emplace(&childEntry.second, childEntry.second.dirs.begin());
+				dstStack.emplace(&dirIt->second);
+			}
 		}
 		else
 		{
@@ -339,4 +616,379 @@ void ModDirectory::merge(ModDirectory&& srcDir)
 	}
 }
 
+
+namespace {
+
+// Category of subdirectory with upper-cased name key
+DirCategory childCategory(DirCategory parent, string const& key)
+{
+	static char const* massFileDirs[] = {
+		"AFFIXES",
+		"CINEMATICS",
+		"DUNGEONS",
+		"FORMATIONS",
+		"GRAPHS",
+		"LAYOUTS",
+		"LEVELSETS",
+		"PARTICLES",
+		"PERKS",
+		"QUESTS",
+		"RECIPES",
+		"SETS",
+		"SKILLS",
+		"SOUNDS",
+		"SPAWNCLASSES",
+		"TRANSLATIONS",
+		"UNITTHEMES",
+		"MODELS"
+	};
+	
+	switch (parent)
+	{
+		case DirCategory::Root:
+			return (key == "MEDIA") ? DirCategory::Media : DirCategory::Other;
+		case DirCategory::Media:
+			if (key == "UI")
+				return DirCategory::Ui;
+			if (key == "UNITS")
+				return DirCategory::Units;
+			
+			for (char const* dir : massFileDirs)
+			{
+				if (key == dir)
+					return DirCategory::MassFile;
+			}
+			return DirCategory::Other;
+		case DirCategory::Units:
+			if (key == "ITEMS")
+				return DirCategory::UnitsItems;
+			if (key == "MONSTERS")
+				return DirCategory::UnitsMonsters;
+			if (key == "PLAYERS")
+				return DirCategory::UnitsPlayers;
+			if (key == "PROPS")
+				return DirCategory::UnitsProps;
+			return DirCategory::Units;
+		default:
+			return parent;
+	}
+}
+
+// Byte-wise order of upper-cased names, same as order of StringLessNoCase for valid UTF-8
+inline bool keyLess(string const& key1, string const& key2)
+{
+	int diff = std::memcmp(key1.data(), key2.data(), std::min(key1.size(), key2.size()));
+	return diff < 0 || (diff == 0 && key1.size() < key2.size());
+}
+
+}
+
+FrozenModDirectory ModDirectory::freeze() const
+{
+	using Dir  = FrozenModDirectory::Dir;
+	using File = FrozenModDirectory::File;
+	
+	FrozenModDirectory frozen;
+	std::vector<ModDirectory const*> srcDirs; // source of each frozen directory
+	std::vector<std::pair<Dir, ModDirectory const*>> children;
+	
+	srcDirs.push_back(this);
+	
+	// Breadth-first, so that subdirectories of each directory end up next to each other
+	for (size_t i = 0; i < srcDirs.size(); ++i)
+	{
+		ModDirectory const& src = *srcDirs[i];
+		size_t firstFile = frozen.m_files.size();
+		
+		for (auto const& entry : src.files)
+		{
+			File file;
+			
+			file.name = entry.first;
+			utf8_to_upper(file.name.data(), file.name.size(), file.key);
+			file.hash = FrozenModDirectory::hashKey(file.key.data(), file.key.size());
+			file.firstSource = (uint32_t)frozen.m_sources.size();
+			file.numSources = (uint32_t)entry.second.size();
+			
+			frozen.m_sources.insert(frozen.m_sources.end(), entry.second.begin(), entry.second.end());
+			frozen.m_files.push_back(std::move(file));
+		}
+		
+		// Maps are already sorted this way for valid UTF-8 names, sort anyway so
+		// that binary search works for any name
+		std::sort(frozen.m_files.begin() + firstFile, frozen.m_files.end(),
+			[&](File const& file1, File const& file2) { return keyLess(file1.key, file2.key); });
+		
+		children.clear();
+		for (auto const& entry : src.dirs)
+		{
+			Dir dir;
+			
+			dir.name = entry.first;
+			utf8_to_upper(dir.name.data(), dir.name.size(), dir.key);
+			dir.hash = FrozenModDirectory::hashKey(dir.key.data(), dir.key.size());
+			dir.parent = (uint32_t)i;
+			dir.category = childCategory(frozen.m_dirs[i].category, dir.key);
+			dir.firstFile = dir.numFiles = dir.firstDir = dir.numDirs = 0;
+			
+			children.push_back(std::make_pair(std::move(dir), &entry.second));
+		}
+		
+		std::sort(children.begin(), children.end(),
+			[&](std::pair<Dir, ModDirectory const*> const& dir1, std::pair<Dir, ModDirectory const*> const& dir2)
+			{ return keyLess(dir1.first.key, dir2.first.key); });
+		
+		Dir& dir = frozen.m_dirs[i];
+		dir.firstFile = (uint32_t)firstFile;
+		dir.numFiles = (uint32_t)(frozen.m_files.size() - firstFile);
+		dir.firstDir = (uint32_t)frozen.m_dirs.size();
+		dir.numDirs = (uint32_t)children.size();
+		
+		for (auto& child : children)
+		{
+			frozen.m_dirs.push_back(std::move(child.first));
+			srcDirs.push_back(child.second);
+		}
+	}
+	
+	return frozen;
+}
+
+
+// ~~ FrozenModDirectory ~~
+
+FrozenModDirectory::FrozenModDirectory()
+{
+	Dir root;
+	
+	root.hash = hashKey("", 0);
+	root.parent = 0;
+	root.category = DirCategory::Root;
+	root.firstFile = root.numFiles = root.firstDir = root.numDirs = 0;
+	
+	m_dirs.push_back(std::move(root));
+}
+
+// FNV-1a
+uint32_t FrozenModDirectory::hashKey(char const* key, size_t len)
+{
+	uint32_t hash = UINT32_C(2166136261);
+	
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= (uint8_t)key[i];
+		hash *= UINT32_C(16777619);
+	}
+	
+	return hash;
+}
+
+template<typename Entry>
+Entry const* FrozenModDirectory::_find(Range<Entry> entries, string const& key, uint32_t hash)
+{
+	Entry const* it;
+	
+	it = std::lower_bound(entries.begin(), entries.end(), key,
+		[](Entry const& entry, string const& searched) { return keyLess(entry.key, searched); });
+	
+	if (it == entries.end() || it->hash != hash || it->key.size() != key.size() ||
+	    std::memcmp(it->key.data(), key.data(), key.size()) != 0)
+		return nullptr;
+	
+	return it;
+}
+
+FrozenModDirectory::File const* FrozenModDirectory::findFile(Dir const& dir, string const& name) const
+{
+	string key;
+	
+	utf8_to_upper(name.data(), name.size(), key);
+	return _find(files(dir), key, hashKey(key.data(), key.size()));
+}
+
+FrozenModDirectory::Dir const* FrozenModDirectory::findDir(Dir const& dir, string const& name) const
+{
+	string key;
+	
+	utf8_to_upper(name.data(), name.size(), key);
+	return _find(dirs(dir), key, hashKey(key.data(), key.size()));
+}
+
+// Walks all directories of the path but the last component, whose position
+// is stored in namePos
+FrozenModDirectory::Dir const* FrozenModDirectory::_lookupParent(
+		StringRef path,
+		size_t& namePos,
+		string& key
+		) const
+{
+	char const *start, *slash;
+	Dir const* dir = &root();
+	
+	for (start = path.begin(); (slash = std::find(start, path.end(), '/')) != path.end(); start = slash+1)
+	{
+		// Ignoring 2 consecutive '/' characters and also root slash
+		if (slash == start)
+			continue;
+		
+		utf8_to_upper(start, slash - start, key);
+		dir = _find(dirs(*dir), key, hashKey(key.data(), key.size()));
+		
+		if (dir == nullptr)
+			return nullptr;
+	}
+	
+	namePos = start - path.begin();
+	return dir;
+}
+
+FrozenModDirectory::File const* FrozenModDirectory::lookupFile(StringRef path) const
+{
+	size_t namePos;
+	Dir const* dir;
+	string key;
+	
+	if (path.empty())
+		return nullptr;
+	
+	if (hasPathIndex())
+		return _lookupIndexed(path);
+	
+	if ((dir = _lookupParent(path, namePos, key)) == nullptr)
+		return nullptr;
+	
+	utf8_to_upper(path.data() + namePos, path.size() - namePos, key);
+	return _find(files(*dir), key, hashKey(key.data(), key.size()));
+}
+
+FrozenModDirectory::Dir const* FrozenModDirectory::lookupDir(string const& path) const
+{
+	size_t namePos;
+	Dir const* dir;
+	string key;
+	
+	if (path.empty() || (dir = _lookupParent(path, namePos, key)) == nullptr)
+		return nullptr;
+	
+	// Trailing slash
+	if (namePos == path.size())
+		return dir;
+	
+	utf8_to_upper(path.data() + namePos, path.size() - namePos, key);
+	return _find(dirs(*dir), key, hashKey(key.data(), key.size()));
+}
+
+void FrozenModDirectory::buildPathIndex()
+{
+	std::vector<string> dirPaths(m_dirs.size());
+	size_t capacity, mask, slot;
+	string path;
+	
+	capacity = 16;
+	while (capacity < m_files.size() * 2)
+		capacity *= 2;
+	mask = capacity - 1;
+	
+	m_pathIndex.assign(capacity, PathIndexEntry{0, 0, 0, 0});
+	m_paths.clear();
+	
+	// Parents always precede their subdirectories
+	for (size_t i = 0; i < m_dirs.size(); ++i)
+	{
+		Dir const& dir = m_dirs[i];
+		
+		if (i != 0)
+		{
+			string const& parentPath = dirPaths[dir.parent];
+			dirPaths[i] = parentPath.empty() ? dir.key : parentPath + '/' + dir.key;
+		}
+		
+		for (uint32_t j = dir.firstFile; j < dir.firstFile + dir.numFiles; ++j)
+		{
+			File const& file = m_files[j];
+			
+			path = dirPaths[i].empty() ? file.key : dirPaths[i] + '/' + file.key;
+			
+			PathIndexEntry entry;
+			entry.hash = hashKey(path.data(), path.size());
+			entry.file = j + 1;
+			entry.pathPos = (uint32_t)m_paths.size();
+			entry.pathLen = (uint32_t)path.size();
+			m_paths += path;
+			
+			for (slot = entry.hash & mask; m_pathIndex[slot].file != 0; slot = (slot + 1) & mask);
+			m_pathIndex[slot] = entry;
+		}
+	}
+}
+
+namespace {
+
+// Copies path, dropping empty components. Returns length of the result or
+// string::npos if the path ends with '/'. out may be equal to path.
+size_t normalizePath(char const* path, size_t len, char* out, bool upperAscii)
+{
+	size_t outLen = 0;
+	bool slash = true;
+	
+	for (size_t i = 0; i < len; ++i)
+	{
+		char c = path[i];
+		
+		if (c == '/')
+		{
+			slash = true;
+			continue;
+		}
+		
+		if (slash && outLen != 0)
+			out[outLen++] = '/';
+		slash = false;
+		
+		out[outLen++] = (upperAscii && c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+	}
+	
+	return slash ? string::npos : outLen;
+}
+
+}
+
+FrozenModDirectory::File const* FrozenModDirectory::_lookupIndexed(StringRef path) const
+{
+	char buf[256];
+	string folded;
+	char* key;
+	size_t len, slot;
+	uint32_t hash;
+	
+	// Paths are short and usually ASCII, so they are upper-cased on the stack
+	if (path.size() <= sizeof(buf) && utf8_ascii_prefix(path.data(), path.size()) == path.size())
+	{
+		key = buf;
+		len = normalizePath(path.data(), path.size(), key, true);
+	}
+	else
+	{
+		utf8_to_upper(path.data(), path.size(), folded);
+		key = &folded[0];
+		len = normalizePath(key, folded.size(), key, false);
+	}
+	
+	if (len == string::npos)
+		return nullptr;
+	
+	hash = hashKey(key, len);
+	
+	for (slot = hash & (m_pathIndex.size() - 1); m_pathIndex[slot].file != 0; slot = (slot + 1) & (m_pathIndex.size() - 1))
+	{
+		PathIndexEntry const& entry = m_pathIndex[slot];
+		
+		if (entry.hash == hash && entry.pathLen == len &&
+		    std::memcmp(m_paths.data() + entry.pathPos, key, len) == 0)
+			return &m_files[entry.file - 1];
+	}
+	
+	return nullptr;
+}
+
 }
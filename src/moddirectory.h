@@ -9,9 +9,13 @@
 #ifndef __TLMODDER_MODDIRECTORY_H__
 #define __TLMODDER_MODDIRECTORY_H__
 
+#include "string_ref.h"
+#include "small_vector.h"
+
+#include <cstdint>
 #include <string>
 #include <map>
-#include <list>
+#include <vector>
 
 namespace tlmodder {
 
@@ -20,14 +24,79 @@ using std::string;
 // Functor used for case-insensitive file search in map
 struct StringLessNoCase
 {
-	bool operator()(string const& str1, string const& str2);
+	bool operator()(string const& str1, string const& str2) const;
 };
 
 struct ModDirectory;
+class FrozenModDirectory;
+
+// Type of on-disk file, decided by its extension when mods are scanned
+enum class FileType : uint8_t
+{
+	Asset,              // copied to output as it is
+	Dat,
+	DatAdm,             // DAT compiled to ADM, in-mod name has ".adm" stripped
+	Animation,
+	AnimationAdm,
+	Layout,
+	LayoutAdm
+};
+
+inline bool isAdmFileType(FileType type)
+{ return type == FileType::DatAdm || type == FileType::AnimationAdm || type == FileType::LayoutAdm; }
+
+// DAT, ANIMATION or LAYOUT, either text or ADM
+inline bool isDatFileType(FileType type)
+{ return type != FileType::Asset; }
+
+// On-disk location of a file provided by a mod
+// Mod root, directory relative to it and file name are interned strings (see
+// internPath()), so paths shared by many files are stored once and full path
+// is built only when the file is opened.
+struct ModSource
+{
+	uint32_t mod;         // mod root directory
+	uint32_t dir;         // directory relative to mod root
+	uint32_t name;        // on-disk filename
+	FileType type;
+	
+	string path() const;
+	string const& fileName() const;
+};
+
+// Returns id of the string, adding it to the table if it isn't there yet
+// Interned strings are never freed. Both functions may be called from multiple threads.
+uint32_t internPath(StringRef str);
+string const& internedPath(uint32_t id);
+
+// How the compiler treats files in a directory, decided by the directory's
+// path and inherited by its subdirectories (see FrozenModDirectory::Dir)
+enum class DirCategory : uint8_t
+{
+	Root,
+	Media,              // MEDIA itself
+	Other,              // no special handling
+	MassFile,           // DATs go into MASSFILE.DAT
+	Ui,                 // MEDIA/UI, DATs go into MASSFILE.DAT, LAYOUTs are XML
+	Units,              // MEDIA/UNITS, other than unit groups below
+	UnitsItems,         // MEDIA/UNITS/ITEMS
+	UnitsMonsters,      // MEDIA/UNITS/MONSTERS
+	UnitsPlayers,       // MEDIA/UNITS/PLAYERS
+	UnitsProps          // MEDIA/UNITS/PROPS
+};
+
+inline bool isMassFileCategory(DirCategory category)
+{ return category == DirCategory::MassFile || category == DirCategory::Ui; }
+
+inline bool isUnitsCategory(DirCategory category)
+{ return category >= DirCategory::Units && category <= DirCategory::UnitsProps; }
+
+// Sources of one file, front() is file from mod with higher priority
+using ModSourceList = SmallVector<ModSource, 1>;
 
 using ModFileMap = std::map<
                      string,            // in-mod filename
-                     std::list<string>, // actual on-disk filenames, front() is file from mod with higher priority
+                     ModSourceList,     // actual on-disk files
                      StringLessNoCase
                      >;
 using ModFileEntry         = ModFileMap::value_type;
@@ -52,11 +121,136 @@ struct ModDirectory
 	bool lookupFile(string const& name, ModFileIterator& it);
 	bool lookupDir(string const& name, ModDirectoryIterator& it);
 	
-	void loadFromDir(string const& modPath);
+	// Scans mod directory into this tree with numThreads threads, 0 means
+	// number of CPUs but at least 4, since scanning mostly waits for disk
+	// If cacheDir isn't empty, unchanged directories are taken from the scan
+	// snapshot kept there, which is then updated (see ScanCache)
+	void loadFromDir(string const& modPath, string const& cacheDir = string(), unsigned numThreads = 0);
 	
 	void merge(ModDirectory&& src);
+	
+	// Creates read-only copy of the tree optimized for traversal and lookup
+	FrozenModDirectory freeze() const;
 };
 
+
+// Read-only form of merged mod tree
+// All directories and files are kept in flat arrays. Entries of each
+// directory are stored contiguously, sorted by their upper-cased name (key),
+// which is the same order ModDirectory maps use. Lookups fold the searched
+// name once and compare keys with memcmp.
+class FrozenModDirectory
+{
+public:
+	template<typename T>
+	class Range
+	{
+		T const* m_begin;
+		T const* m_end;
+	public:
+		Range(T const* begin, T const* end): m_begin(begin), m_end(end) {}
+		
+		T const* begin() const { return m_begin; }
+		T const* end() const { return m_end; }
+		size_t size() const { return m_end - m_begin; }
+		bool empty() const { return m_begin == m_end; }
+		T const& operator[](size_t i) const { return m_begin[i]; }
+	};
+	
+	struct File
+	{
+		string name;          // in-mod filename
+		string key;           // upper-cased name
+		uint32_t hash;        // hash of key
+		uint32_t firstSource; // on-disk filenames in m_sources, first is from mod with higher priority
+		uint32_t numSources;
+	};
+	
+	struct Dir
+	{
+		string name;          // in-mod directory name, empty for root
+		string key;           // upper-cased name
+		uint32_t hash;        // hash of key
+		uint32_t parent;      // index of parent directory, root is its own parent
+		DirCategory category;
+		uint32_t firstFile;
+		uint32_t numFiles;
+		uint32_t firstDir;
+		uint32_t numDirs;
+	};
+	
+	FrozenModDirectory();
+	
+	Dir const& root() const
+	{ return m_dirs.front(); }
+	
+	Dir const& parent(Dir const& dir) const
+	{ return m_dirs[dir.parent]; }
+	
+	Range<File> files(Dir const& dir) const
+	{ return {m_files.data() + dir.firstFile, m_files.data() + dir.firstFile + dir.numFiles}; }
+	
+	Range<Dir> dirs(Dir const& dir) const
+	{ return {m_dirs.data() + dir.firstDir, m_dirs.data() + dir.firstDir + dir.numDirs}; }
+	
+	Range<ModSource> sources(File const& file) const
+	{ return {m_sources.data() + file.firstSource, m_sources.data() + file.firstSource + file.numSources}; }
+	
+	// On-disk file from mod with the highest priority
+	ModSource const& source(File const& file) const
+	{ return m_sources[file.firstSource]; }
+	
+	size_t numFiles() const
+	{ return m_files.size(); }
+	
+	size_t numDirs() const
+	{ return m_dirs.size(); }
+	
+	// Case-insensitive lookup of direct child, returns nullptr if not found
+	File const* findFile(Dir const& dir, string const& name) const;
+	Dir const* findDir(Dir const& dir, string const& name) const;
+	
+	// Case-insensitive lookup of '/' separated path relative to the root,
+	// returns nullptr if not found
+	File const* lookupFile(StringRef path) const;
+	Dir const* lookupDir(string const& path) const;
+	
+	// Builds hash index of upper-cased full paths of all files, lookupFile()
+	// then does single probe instead of walking the tree
+	void buildPathIndex();
+	
+	bool hasPathIndex() const
+	{ return !m_pathIndex.empty(); }
+	
+	static uint32_t hashKey(char const* key, size_t len);
+protected:
+	struct PathIndexEntry
+	{
+		uint32_t hash;
+		uint32_t file;        // index into m_files plus one, 0 for empty slot
+		uint32_t pathPos;     // upper-cased full path in m_paths
+		uint32_t pathLen;
+	};
+	
+	template<typename Entry>
+	static Entry const* _find(Range<Entry> entries, string const& key, uint32_t hash);
+	
+	Dir const* _lookupParent(StringRef path, size_t& namePos, string& key) const;
+	File const* _lookupIndexed(StringRef path) const;
+protected:
+	std::vector<Dir> m_dirs;      // m_dirs[0] is root
+	std::vector<File> m_files;
+	std::vector<ModSource> m_sources;
+	
+	std::vector<PathIndexEntry> m_pathIndex; // open addressing, size is power of 2
+	string m_paths;
+	
+	friend struct ModDirectory;
+};
+
+using FrozenModFile = FrozenModDirectory::File;
+using FrozenModDir  = FrozenModDirectory::Dir;
+
 }
 
 #endif
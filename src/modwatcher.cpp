@@ -0,0 +1,180 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "modwatcher.h"
+#include "moddirectory.h"
+#include "filename_utils.h"
+#include "dir_iterator.h"
+#include "unicode.h"
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <iostream>
+#include <stdexcept>
+
+namespace tlmodder {
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+}
+
+ModWatcher::ModWatcher():
+	m_limitReported(false)
+{
+	m_fd = ::inotify_init1(IN_CLOEXEC);
+	
+	if (m_fd == -1)
+		throw std::runtime_error("inotify is not available");
+}
+
+ModWatcher::~ModWatcher()
+{
+	::close(m_fd);
+}
+
+void ModWatcher::addMod(string const& modPath)
+{
+	_addDir(modPath, string(), 0);
+}
+
+void ModWatcher::_addDir(string const& modPath, string const& relativeDir, unsigned depth)
+{
+	FileName path(modPath);
+	string fileName, fileNameUpper;
+	DirIterator::EntryType type;
+	DirIterator dir;
+	int wd;
+	
+	if (!relativeDir.empty())
+		path.cd(relativeDir);
+	
+	wd = ::inotify_add_watch(m_fd, path.str().c_str(), WATCH_MASK);
+	
+	if (wd == -1)
+	{
+		if (errno == ENOSPC && !m_limitReported)
+		{
+			std::cerr << "WARNING: inotify watch limit reached, changes in some directories won't be noticed."
+			          << " Raise fs.inotify.max_user_watches to watch all of them." << std::endl;
+			m_limitReported = true;
+		}
+		return;
+	}
+	
+	m_dirs[wd] = WatchedDir{modPath, relativeDir, depth};
+	
+	// Directory was removed meanwhile
+	if (!dir.open(std::nothrow, path.str()))
+		return;
+	
+	while (dir.next(fileName, type))
+	{
+		if (type != DirIterator::TYPE_DIR)
+			continue;
+		
+		// Only media directory is scanned in mod root
+		if (depth == 0)
+		{
+			utf8_to_upper(fileName.data(), fileName.size(), fileNameUpper);
+			if (fileNameUpper != "MEDIA")
+				continue;
+		}
+		
+		_addDir(modPath, FileName::build(relativeDir, fileName), depth + 1);
+	}
+}
+
+bool ModWatcher::wait(ChangedFiles& changed)
+{
+	struct pollfd pfd;
+	bool complete = true;
+	int timeout = -1;
+	
+	pfd.fd = m_fd;
+	pfd.events = POLLIN;
+	
+	for (;;)
+	{
+		int ready = ::poll(&pfd, 1, timeout);
+		
+		if (ready == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("poll() failed on inotify descriptor");
+		}
+		
+		// Quiet for long enough
+		if (ready == 0)
+			return complete;
+		
+		if (!_readEvents(changed))
+			complete = false;
+		
+		timeout = QUIET_MS;
+	}
+}
+
+bool ModWatcher::_readEvents(ChangedFiles& changed)
+{
+	alignas(struct inotify_event) char buf[64 * 1024];
+	bool complete = true;
+	ssize_t size;
+	
+	size = ::read(m_fd, buf, sizeof(buf));
+	
+	if (size <= 0)
+		return (size == -1 && (errno == EINTR || errno == EAGAIN));
+	
+	for (char const* ptr = buf; ptr < buf + size; )
+	{
+		struct inotify_event const* event = (struct inotify_event const*)ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+		
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+			complete = false;
+			continue;
+		}
+		
+		auto it = m_dirs.find(event->wd);
+		if (it == m_dirs.end())
+			continue;
+		
+		// Watch is removed with its directory
+		if (event->mask & IN_IGNORED)
+		{
+			m_dirs.erase(it);
+			continue;
+		}
+		
+		if (event->len == 0)
+			continue;
+		
+		// Copied, because _addDir() may rehash m_dirs
+		WatchedDir dir = it->second;
+		string name = event->name;
+		
+		changed.insert(std::make_tuple(internPath(dir.modPath), internPath(dir.relativeDir), internPath(name)));
+		
+		if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+		{
+			if (dir.depth != 0 || utf8_to_upper(name) == "MEDIA")
+				_addDir(dir.modPath, FileName::build(dir.relativeDir, name), dir.depth + 1);
+		}
+	}
+	
+	return complete;
+}
+
+}
@@ -0,0 +1,72 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_MODWATCHER_H__
+#define __TLMODDER_MODWATCHER_H__
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+namespace tlmodder {
+
+using std::string;
+
+// Watches mod directories for changes with inotify
+// Same directories which ModDirectory::loadFromDir() scans are watched, that
+// is the mod root and everything in its media directory. Directories created
+// later are watched as soon as their creation is noticed.
+class ModWatcher
+{
+public:
+	// On-disk file which changed, ids are interned strings as in ModSource
+	using ChangedFile  = std::tuple<
+	                       uint32_t,    // mod root directory
+	                       uint32_t,    // directory relative to mod root
+	                       uint32_t     // on-disk filename
+	                       >;
+	using ChangedFiles = std::set<ChangedFile>;
+	
+	// Changes closer to each other than this are reported together, so that
+	// saving several files or unpacking a mod causes single update
+	static const int QUIET_MS = 200;
+	
+	// Throws std::runtime_error if inotify is not available
+	ModWatcher();
+	~ModWatcher();
+	
+	ModWatcher(ModWatcher const&) = delete;
+	ModWatcher& operator=(ModWatcher const&) = delete;
+	
+	void addMod(string const& modPath);
+	
+	// Blocks until something changes in watched directories and then until
+	// there is no change for QUIET_MS, adds changed files to 'changed'
+	// Returns false if kernel dropped some events, any file may have changed then.
+	bool wait(ChangedFiles& changed);
+protected:
+	struct WatchedDir
+	{
+		string modPath;
+		string relativeDir;
+		unsigned depth;
+	};
+	
+	void _addDir(string const& modPath, string const& relativeDir, unsigned depth);
+	bool _readEvents(ChangedFiles& changed);
+protected:
+	int m_fd;
+	std::unordered_map<int, WatchedDir> m_dirs;   // by watch descriptor
+	bool m_limitReported;
+};
+
+}
+
+#endif
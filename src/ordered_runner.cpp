@@ -0,0 +1,119 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "ordered_runner.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tlmodder {
+
+void runOrdered(
+	size_t count,
+	unsigned numThreads,
+	size_t window,
+	std::function<void(size_t)> const& work,
+	std::function<void(size_t)> const& commit)
+{
+	std::vector<std::thread> workers;
+	std::vector<bool> done(count, false);
+	std::mutex mutex;
+	std::condition_variable workAvailable, workDone;
+	size_t next = 0, committed = 0;
+	bool stop = false;
+	
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	
+	window = std::max<size_t>(window, 1);
+	
+	// Following two are called with mutex locked
+	auto take = [&](size_t& i) -> bool
+	{
+		if (stop || next >= count || next >= committed + window)
+			return false;
+		
+		i = next++;
+		return true;
+	};
+	
+	auto run = [&](std::unique_lock<std::mutex>& lock, size_t i)
+	{
+		lock.unlock();
+		work(i);
+		lock.lock();
+		
+		done[i] = true;
+		workDone.notify_one();
+	};
+	
+	auto worker = [&]()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		size_t i;
+		
+		for (;;)
+		{
+			if (take(i))
+				run(lock, i);
+			else if (stop || next >= count)
+				return;
+			else
+				workAvailable.wait(lock);
+		}
+	};
+	
+	for (unsigned i = 1; i < numThreads; ++i)
+		workers.emplace_back(worker);
+	
+	try {
+		std::unique_lock<std::mutex> lock(mutex);
+		size_t i;
+		
+		while (committed < count)
+		{
+			// Calling thread works too while the next item to commit isn't done
+			if (!done[committed])
+			{
+				if (take(i))
+					run(lock, i);
+				else
+					workDone.wait(lock);
+				continue;
+			}
+			
+			lock.unlock();
+			commit(committed);
+			lock.lock();
+			
+			++committed;
+			workAvailable.notify_one();
+		}
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		
+		workAvailable.notify_all();
+		
+		for (std::thread& thread : workers)
+			thread.join();
+		throw;
+	}
+	
+	for (std::thread& thread : workers)
+		thread.join();
+}
+
+}
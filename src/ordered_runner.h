@@ -0,0 +1,34 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_ORDERED_RUNNER_H__
+#define __TLMODDER_ORDERED_RUNNER_H__
+
+#include <cstddef>
+#include <functional>
+
+namespace tlmodder {
+
+// Runs work(i) for each i in [0, count) on numThreads threads, the calling
+// thread included, 0 means number of CPUs. commit(i) is called on the calling
+// thread in order of i as soon as work(i) is done, so results can be applied
+// to shared state in the same order as by a single thread. Work is started at
+// most 'window' items ahead of the next commit, which bounds memory held by
+// results waiting for it.
+// work must not throw. If commit throws, no more work is started, running
+// work is waited for and the exception is rethrown.
+void runOrdered(
+	size_t count,
+	unsigned numThreads,
+	size_t window,
+	std::function<void(size_t)> const& work,
+	std::function<void(size_t)> const& commit);
+
+}
+
+#endif
@@ -0,0 +1,631 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "output_writer.h"
+#include "file_copy.h"
+
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace tlmodder {
+
+OutputWriter::OutputWriter(bool preserveAttributes):
+	m_ring(MAX_IN_FLIGHT * 4, {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE,
+	                                IORING_OP_MKDIRAT, IORING_OP_UNLINKAT, IORING_OP_LINKAT, IORING_OP_SYMLINKAT}),
+	m_preserveAttributes(preserveAttributes),
+	m_wakeValue(0),
+	m_inFlight(0),
+	m_inRing(0),
+	m_wakePending(false),
+	m_busy(false),
+	m_sleeping(false),
+	m_sleepingIdle(false),
+	m_stop(false),
+	m_failed(false)
+{
+	if ((m_wakeFd = ::eventfd(0, EFD_CLOEXEC)) == -1)
+		throw IoRing::NotAvailable("cannot create eventfd");
+	
+	m_thread = std::thread(&OutputWriter::_run, this);
+}
+
+OutputWriter::~OutputWriter()
+{
+	uint64_t one = 1;
+	
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	
+	// Also completes the pending read, so that the thread can leave the ring empty
+	if (::write(m_wakeFd, &one, sizeof(one)) != sizeof(one))
+		std::cerr << "WARNING: cannot wake output writer: " << std::strerror(errno) << std::endl;
+	
+	m_thread.join();
+	::close(m_wakeFd);
+}
+
+void OutputWriter::mkdir(string const& path)
+{
+	_push(new Op(Op::MKDIR, path));
+}
+
+void OutputWriter::write(string const& path, string&& data)
+{
+	Op* op = new Op(Op::WRITE, path);
+	op->data = std::move(data);
+	
+	_push(op);
+}
+
+void OutputWriter::copy(string const& src, string const& dst)
+{
+	Op* op = new Op(Op::COPY, dst);
+	op->src = src;
+	
+	_push(op);
+}
+
+void OutputWriter::link(string const& src, string const& dst)
+{
+	Op* op = new Op(Op::LINK, dst);
+	op->src = src;
+	
+	_push(op);
+}
+
+void OutputWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	m_cond.wait(lock, [this]() { return (m_queue.empty() && !m_busy) || m_failed; });
+	
+	if (!m_error.empty())
+	{
+		std::cerr << m_error << std::endl;
+		m_error.clear();
+		throw std::runtime_error("Cannot write output files");
+	}
+}
+
+void OutputWriter::_push(Op* op)
+{
+	std::unique_ptr<Op> owned(op);
+	uint64_t one = 1;
+	bool wake;
+	
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		
+		m_cond.wait(lock, [this]() { return m_queue.size() < MAX_QUEUED || m_failed; });
+		
+		// Failure is reported by flush()
+		if (m_failed)
+			return;
+		
+		m_queue.push_back(owned.release());
+		
+		// Busy thread takes new operations after its next completion, it is
+		// woken up only to keep whole batches coming
+		wake = m_sleeping && (m_sleepingIdle || m_queue.size() >= SUBMIT_BATCH);
+		if (wake)
+			m_sleeping = false;
+	}
+	
+	if (wake && ::write(m_wakeFd, &one, sizeof(one)) != sizeof(one))
+		std::cerr << "WARNING: cannot wake output writer: " << std::strerror(errno) << std::endl;
+}
+
+void OutputWriter::_run()
+{
+	std::vector<Op*> ops;
+	bool idle, stopping, stop;
+	
+	try {
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				
+				while (!m_queue.empty() && m_inFlight + ops.size() < MAX_IN_FLIGHT)
+				{
+					ops.push_back(m_queue.front());
+					m_queue.pop_front();
+				}
+				
+				idle = ops.empty();
+				m_busy = !idle || m_inFlight != 0;
+				m_sleeping = idle;
+				m_sleepingIdle = idle && m_inFlight == 0;
+				stopping = m_stop;
+				stop = stopping && !m_busy && m_queue.empty();
+				
+				// There is room in the queue, or flush() may be done
+				m_cond.notify_all();
+			}
+			
+			if (stop && !m_wakePending)
+				return;
+			
+			// Destructor signals m_wakeFd only once, after it set m_stop
+			if (!stopping && !m_wakePending)
+				_prepWakeRead();
+			
+			for (Op* op : ops)
+				_queue(op);
+			ops.clear();
+			
+			// Waits for a completion or for a new operation
+			if (idle)
+			{
+				_reap(true);
+			}
+			else
+			{
+				m_ring.submit();
+				_reap(false);
+			}
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		
+		// Operations in the ring are abandoned, the output is unusable anyway
+		for (Op* op : m_queue)
+			delete op;
+		m_queue.clear();
+		
+		if (m_error.empty())
+			m_error = string("Output writer failed: ") + e.what();
+		
+		m_failed = true;
+		m_cond.notify_all();
+	}
+}
+
+void OutputWriter::_prepWakeRead()
+{
+	struct io_uring_sqe* sqe;
+	
+	if ((sqe = m_ring.sqe()) == nullptr)
+	{
+		m_ring.submit();
+		sqe = m_ring.sqe();
+		
+		if (sqe == nullptr)
+			throw std::runtime_error("io_uring submission queue is full");
+	}
+	
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = m_wakeFd;
+	sqe->addr = (uintptr_t)&m_wakeValue;
+	sqe->len = sizeof(m_wakeValue);
+	sqe->user_data = WAKE_TAG;
+	
+	m_wakePending = true;
+}
+
+void OutputWriter::_setError(string const& error)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (m_error.empty())
+		m_error = error;
+}
+
+void OutputWriter::_submit()
+{
+	if (m_ring.queued() >= SUBMIT_BATCH)
+		m_ring.submit();
+}
+
+void OutputWriter::_queue(Op* op)
+{
+	size_t slash;
+	
+	while (m_inFlight >= MAX_IN_FLIGHT)
+		_reap(true);
+	
+	++m_inFlight;
+	
+	// Files and directories in directory which is being created have to wait for it
+	slash = op->path.rfind('/');
+	auto parent = (slash != string::npos) ? m_creatingDirs.find(op->path.substr(0, slash)) : m_creatingDirs.end();
+	
+	if (parent != m_creatingDirs.end())
+		parent->second.push_back(op);
+	else
+		_start(op);
+	
+	if (op->kind == Op::MKDIR)
+		m_creatingDirs[op->path];
+}
+
+void OutputWriter::_start(Op* op)
+{
+	struct io_uring_sqe* sqe;
+	
+	switch (op->kind)
+	{
+	case Op::MKDIR:
+		sqe = _sqe(op, false);
+		sqe->opcode = IORING_OP_MKDIRAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)op->path.c_str();
+		sqe->len = S_IRWXU | S_IRGRP | S_IXGRP;
+		break;
+	
+	case Op::WRITE:
+		_prepOpen(op, false);
+		break;
+	
+	case Op::COPY:
+		_prepOpen(op, true);
+		break;
+		
+	case Op::LINK:
+		op->state = Op::HARDLINK;
+		_prepLink(op);
+		break;
+	}
+}
+
+void OutputWriter::_complete(Op* op, bool isSrc, int res)
+{
+	--op->pending;
+	
+	// Existing file was removed, try to create it again
+	if (!isSrc && op->unlinking)
+	{
+		op->unlinking = false;
+		
+		if (res == 0 || res == -ENOENT)
+		{
+			if (op->state == Op::OPEN)
+				_prepOpen(op, false);
+			else
+				_prepLink(op);
+			return;
+		}
+	}
+	else if (res == -EEXIST && !op->unlinked && !isSrc && op->kind != Op::MKDIR &&
+	         (op->state == Op::OPEN || op->state == Op::HARDLINK))
+	{
+		op->unlinking = op->unlinked = true;
+		_prepUnlink(op);
+		return;
+	}
+	
+	if (op->kind == Op::LINK)
+	{
+		if (res == 0)
+		{
+			_finish(op);
+		}
+		else if (op->state == Op::HARDLINK && (res == -EXDEV || res == -EPERM || res == -EMLINK))
+		{
+			op->state = Op::SYMLINK;
+			_prepSymlink(op);
+		}
+		else
+		{
+			// Neither link can be created, copy the file instead
+			op->kind = Op::COPY;
+			op->state = Op::OPEN;
+			op->unlinked = false;
+			_start(op);
+		}
+		return;
+	}
+	
+	if (res < 0 && op->error == 0)
+		op->error = -res;
+	
+	if (op->kind == Op::MKDIR)
+	{
+		if (op->error == EEXIST)
+			op->error = 0;
+		
+		_finish(op);
+		return;
+	}
+	
+	switch (op->state)
+	{
+	case Op::OPEN:
+		if (res >= 0)
+			(isSrc ? op->srcFd : op->fd) = res;
+		
+		if (op->error != 0)
+		{
+			_fail(op);
+			return;
+		}
+		
+		// Output of copy is opened only after its source, so that copy which
+		// fails leaves existing output as it is, same as copyFileData()
+		if (isSrc)
+		{
+			_prepOpen(op, false);
+		}
+		else if (op->kind == Op::COPY)
+		{
+			op->data.resize(COPY_CHUNK);
+			op->state = Op::READ;
+			_prepRead(op);
+		}
+		else if (!op->data.empty())
+		{
+			op->dataSize = op->data.size();
+			op->state = Op::WRITING;
+			_prepWrite(op);
+		}
+		else
+		{
+			op->state = Op::CLOSE;
+			_prepClose(op, false);
+		}
+		break;
+	
+	case Op::READ:
+		if (res < 0)
+		{
+			_fail(op);
+		}
+		else if (res == 0)
+		{
+			// Few synchronous calls, only done when asked for
+			if (m_preserveAttributes && !copyFileAttributes(op->srcFd, op->fd))
+			{
+				op->error = errno;
+				_fail(op);
+				return;
+			}
+			
+			op->state = Op::CLOSE;
+			_prepClose(op, true);
+			_prepClose(op, false);
+		}
+		else
+		{
+			op->dataSize = (size_t)res;
+			op->written = 0;
+			op->state = Op::WRITING;
+			_prepWrite(op);
+		}
+		break;
+	
+	case Op::WRITING:
+		// Nothing written without error means the device is full
+		if (res <= 0)
+		{
+			if (op->error == 0)
+				op->error = ENOSPC;
+			_fail(op);
+			return;
+		}
+		
+		op->written += (size_t)res;
+		
+		if (op->written < op->dataSize)
+		{
+			_prepWrite(op);
+		}
+		else if (op->kind == Op::COPY)
+		{
+			op->offset += op->dataSize;
+			op->state = Op::READ;
+			_prepRead(op);
+		}
+		else
+		{
+			op->state = Op::CLOSE;
+			_prepClose(op, false);
+		}
+		break;
+	
+	case Op::CLOSE:
+		if (op->pending != 0)
+			return;
+		
+		if (op->error != 0)
+			_fail(op);
+		else
+			_finish(op);
+		break;
+		
+	case Op::HARDLINK:
+	case Op::SYMLINK:
+		// Only links are in these states, handled above
+		break;
+	}
+}
+
+void OutputWriter::_fail(Op* op)
+{
+	// Descriptors which are still open, failures are rare enough to close them directly
+	if (op->state != Op::CLOSE)
+	{
+		if (op->fd != -1)
+			::close(op->fd);
+		if (op->srcFd != -1)
+			::close(op->srcFd);
+	}
+	
+	if (op->kind == Op::COPY)
+		_setError("Failed to copy " + op->src + " into output directory: " + std::strerror(op->error));
+	else
+		_setError("Failed to write " + op->path + ": " + std::strerror(op->error));
+	
+	_finish(op);
+}
+
+void OutputWriter::_finish(Op* op)
+{
+	--m_inFlight;
+	
+	if (op->kind == Op::MKDIR)
+	{
+		auto it = m_creatingDirs.find(op->path);
+		std::vector<Op*> waiting = std::move(it->second);
+		
+		m_creatingDirs.erase(it);
+		
+		if (op->error != 0)
+			_setError("Failed to create directory " + op->path + ": " + std::strerror(op->error));
+		
+		// Failed directory makes its files fail too, which is reported only once
+		for (Op* waitingOp : waiting)
+			_start(waitingOp);
+	}
+	
+	delete op;
+}
+
+struct io_uring_sqe* OutputWriter::_sqe(Op* op, bool isSrc)
+{
+	struct io_uring_sqe* sqe;
+	
+	// Submitting makes room, kernel takes entries from the queue right away
+	if ((sqe = m_ring.sqe()) == nullptr)
+	{
+		m_ring.submit();
+		sqe = m_ring.sqe();
+		
+		if (sqe == nullptr)
+			throw std::runtime_error("io_uring submission queue is full");
+	}
+	
+	sqe->user_data = (uintptr_t)op | (isSrc ? SRC_TAG : 0);
+	++op->pending;
+	++m_inRing;
+	
+	return sqe;
+}
+
+void OutputWriter::_prepOpen(Op* op, bool isSrc)
+{
+	struct io_uring_sqe* sqe = _sqe(op, isSrc);
+	
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	
+	if (isSrc)
+	{
+		sqe->addr = (uintptr_t)op->src.c_str();
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	}
+	else
+	{
+		sqe->addr = (uintptr_t)op->path.c_str();
+		// Existing file is replaced, it may be link to source file, see copyFileData()
+		sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+		sqe->len = 0666;
+	}
+}
+
+void OutputWriter::_prepRead(Op* op)
+{
+	struct io_uring_sqe* sqe = _sqe(op, true);
+	
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = op->srcFd;
+	sqe->addr = (uintptr_t)&op->data[0];
+	sqe->len = (uint32_t)op->data.size();
+	sqe->off = op->offset;
+}
+
+void OutputWriter::_prepWrite(Op* op)
+{
+	struct io_uring_sqe* sqe = _sqe(op, false);
+	
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = op->fd;
+	sqe->addr = (uintptr_t)&op->data[op->written];
+	sqe->len = (uint32_t)(op->dataSize - op->written);
+	sqe->off = op->offset + op->written;
+}
+
+void OutputWriter::_prepClose(Op* op, bool isSrc)
+{
+	struct io_uring_sqe* sqe = _sqe(op, isSrc);
+	
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = isSrc ? op->srcFd : op->fd;
+}
+
+void OutputWriter::_prepUnlink(Op* op)
+{
+	struct io_uring_sqe* sqe = _sqe(op, false);
+	
+	sqe->opcode = IORING_OP_UNLINKAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)op->path.c_str();
+}
+
+void OutputWriter::_prepLink(Op* op)
+{
+	struct io_uring_sqe* sqe = _sqe(op, false);
+	
+	sqe->opcode = IORING_OP_LINKAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)op->src.c_str();
+	sqe->len = (uint32_t)AT_FDCWD;
+	sqe->addr2 = (uintptr_t)op->path.c_str();
+}
+
+void OutputWriter::_prepSymlink(Op* op)
+{
+	struct io_uring_sqe* sqe = _sqe(op, false);
+	
+	sqe->opcode = IORING_OP_SYMLINKAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)op->src.c_str();
+	sqe->addr2 = (uintptr_t)op->path.c_str();
+}
+
+void OutputWriter::_reap(bool wait)
+{
+	struct io_uring_cqe const* cqe;
+	uintptr_t userData;
+	int res;
+	
+	// Waiting for more completions at once saves syscalls, but only for entries
+	// which are surely in the ring, read of m_wakeFd may never complete
+	if (wait && m_ring.peek() == nullptr)
+		m_ring.submit((m_inRing > SUBMIT_BATCH) ? SUBMIT_BATCH : (m_inRing != 0) ? m_inRing : 1);
+	
+	while ((cqe = m_ring.peek()) != nullptr)
+	{
+		userData = (uintptr_t)cqe->user_data;
+		res = cqe->res;
+		m_ring.pop();
+		
+		// Only wakes the thread up, the read is queued again by _run()
+		if (userData == WAKE_TAG)
+		{
+			m_wakePending = false;
+			continue;
+		}
+		
+		--m_inRing;
+		_complete((Op*)(userData & ~SRC_TAG), (userData & SRC_TAG) != 0, res);
+	}
+}
+
+}
@@ -0,0 +1,170 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_OUTPUT_WRITER_H__
+#define __TLMODDER_OUTPUT_WRITER_H__
+
+#include "io_ring.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace tlmodder {
+
+using std::string;
+
+// Creates output directories and files through io_uring
+// Each call only queues the operation and may be made from any thread. A
+// writer thread owns the ring and drives each operation through its steps
+// (link, open, read, write, close) as the kernel completes them, with up to
+// MAX_IN_FLIGHT operations at once. Callers only wait when MAX_QUEUED
+// operations are waiting for the writer. Operations on files in a directory
+// which is still being created wait for it, so directories have to be queued
+// before their files. Failures are collected and reported by flush(), which
+// must be called before output files are used.
+class OutputWriter
+{
+public:
+	static const unsigned MAX_IN_FLIGHT = 64;
+	static const unsigned MAX_QUEUED = 256;
+	static const size_t COPY_CHUNK = 256 * 1024;
+	
+	// Queued entries are submitted together once there are this many of them,
+	// or when waiting for completions
+	static const unsigned SUBMIT_BATCH = 16;
+	
+	// Throws IoRing::NotAvailable if io_uring cannot be used
+	// Copied files get permissions and times of their sources if preserveAttributes is set.
+	OutputWriter(bool preserveAttributes);
+	
+	// Waits for queued operations, errors are ignored
+	~OutputWriter();
+	
+	OutputWriter(OutputWriter const&) = delete;
+	OutputWriter& operator=(OutputWriter const&) = delete;
+	
+	// Existing directory is not an error
+	void mkdir(string const& path);
+	void write(string const& path, string&& data);
+	void copy(string const& src, string const& dst);
+	
+	// Same as linkFile(), copies the file if it cannot be linked
+	void link(string const& src, string const& dst);
+	
+	// Waits until all queued operations finish, throws std::runtime_error
+	// describing the first failure. No operations may be queued meanwhile.
+	void flush();
+protected:
+	struct Op
+	{
+		enum Kind
+		{
+			MKDIR,
+			WRITE,
+			COPY,
+			LINK
+		};
+		
+		enum State
+		{
+			OPEN,
+			READ,
+			WRITING,
+			CLOSE,
+			HARDLINK,
+			SYMLINK
+		};
+		
+		Kind kind;
+		State state;
+		string path;          // created directory or file
+		string src;           // copied or linked file
+		string data;          // written data, or buffer when copying
+		int fd;
+		int srcFd;
+		unsigned pending;     // submitted entries not completed yet
+		uint64_t offset;      // file offset of data
+		size_t dataSize;      // bytes of data to write
+		size_t written;       // bytes of data already written
+		int error;            // errno of the first failure
+		bool unlinking;       // existing file is being removed
+		bool unlinked;        // existing file was removed, it is not done twice
+		
+		Op(Kind kind, string const& path):
+			kind(kind), state(OPEN), path(path), fd(-1), srcFd(-1), pending(0),
+			offset(0), dataSize(0), written(0), error(0), unlinking(false), unlinked(false)
+		{}
+	};
+	
+	// User data of entries submitted for source file of a copy have this bit set
+	static const uintptr_t SRC_TAG = 1;
+	
+	// User data of read of m_wakeFd, which is always pending in the ring
+	static const uintptr_t WAKE_TAG = 0;
+	
+	// Called by other threads
+	void _push(Op* op);
+	
+	// Following are only called by the writer thread
+	void _run();
+	void _prepWakeRead();
+	void _setError(string const& error);
+	
+	void _queue(Op* op);
+	void _submit();
+	void _start(Op* op);
+	void _complete(Op* op, bool isSrc, int res);
+	void _fail(Op* op);
+	void _finish(Op* op);
+	
+	void _prepOpen(Op* op, bool isSrc);
+	void _prepRead(Op* op);
+	void _prepWrite(Op* op);
+	void _prepClose(Op* op, bool isSrc);
+	void _prepUnlink(Op* op);
+	void _prepLink(Op* op);
+	void _prepSymlink(Op* op);
+	struct io_uring_sqe* _sqe(Op* op, bool isSrc);
+	
+	// Processes available completions, waiting for some if 'wait' is set
+	void _reap(bool wait);
+protected:
+	IoRing m_ring;
+	bool m_preserveAttributes;
+	int m_wakeFd;                     // eventfd which wakes the writer thread
+	uint64_t m_wakeValue;             // buffer of its read
+	
+	// Only used by the writer thread
+	unsigned m_inFlight;
+	unsigned m_inRing;                // submitted entries of ops, without read of m_wakeFd
+	bool m_wakePending;               // read of m_wakeFd is in the ring
+	std::unordered_map<string, std::vector<Op*>> m_creatingDirs;  // ops waiting for directory
+	
+	// Following are guarded by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Op*> m_queue;          // ops not taken by the writer thread yet
+	bool m_busy;                      // writer thread has ops in flight
+	bool m_sleeping;                  // writer thread waits for the ring, m_wakeFd has to be signalled
+	bool m_sleepingIdle;              // and no completion will wake it up
+	bool m_stop;
+	bool m_failed;                    // writer thread stopped because of unexpected error
+	string m_error;
+	
+	std::thread m_thread;
+};
+
+}
+
+#endif
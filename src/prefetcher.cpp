@@ -0,0 +1,102 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "prefetcher.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tlmodder {
+
+Prefetcher::Prefetcher(FrozenModDirectory const& files, size_t distance, Filter filter):
+	m_files(files),
+	m_distance(distance),
+	m_filter(std::move(filter)),
+	m_consumed(0),
+	m_issued(0),
+	m_stop(false)
+{
+	m_thread = std::thread(&Prefetcher::_run, this);
+}
+
+Prefetcher::~Prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	
+	m_cond.notify_all();
+	m_thread.join();
+}
+
+void Prefetcher::advance()
+{
+	bool wake;
+	
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_consumed;
+		wake = (m_issued == m_consumed - 1 + m_distance);
+	}
+	
+	// Thread sleeps only when it is exactly 'distance' files ahead
+	if (wake)
+		m_cond.notify_one();
+}
+
+void Prefetcher::_run()
+{
+	_prefetchDir(m_files.root());
+}
+
+bool Prefetcher::_prefetchDir(FrozenModDir const& dir)
+{
+	int fd;
+	
+	// Same order as ModCompiler::_compileTree(), files first and then subdirectories
+	for (FrozenModFile const& file : m_files.files(dir))
+	{
+		if (m_filter && !m_filter(dir, file))
+			continue;
+		
+		if (!_waitForTurn())
+			return false;
+		
+		fd = ::open(m_files.source(file).path().c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+		
+		::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		::close(fd);
+	}
+	
+	for (FrozenModDir const& subdir : m_files.dirs(dir))
+	{
+		if (!_prefetchDir(subdir))
+			return false;
+	}
+	
+	return true;
+}
+
+bool Prefetcher::_waitForTurn()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	m_cond.wait(lock, [this]() { return m_stop || m_issued < m_consumed + m_distance; });
+	
+	if (m_stop)
+		return false;
+	
+	++m_issued;
+	return true;
+}
+
+}
@@ -0,0 +1,68 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_PREFETCHER_H__
+#define __TLMODDER_PREFETCHER_H__
+
+#include "moddirectory.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace tlmodder {
+
+// Asks the kernel to read source files before the compiler opens them
+// A background thread walks the frozen tree in the same order as
+// ModCompiler::_compileTree() and issues posix_fadvise(POSIX_FADV_WILLNEED)
+// for files at most 'distance' files ahead of the compiler, so that disk
+// reads overlap with parsing and writing of earlier files. It is only a hint,
+// files which cannot be opened are skipped.
+class Prefetcher
+{
+public:
+	// Tells which files are read in the phase being prefetched, others are
+	// neither prefetched nor counted by advance()
+	using Filter = std::function<bool(FrozenModDir const& dir, FrozenModFile const& file)>;
+	
+	// Empty filter takes all files
+	Prefetcher(FrozenModDirectory const& files, size_t distance, Filter filter = Filter());
+	
+	// Stops the thread without waiting for the walk to finish
+	~Prefetcher();
+	
+	Prefetcher(Prefetcher const&) = delete;
+	Prefetcher& operator=(Prefetcher const&) = delete;
+	
+	// Called by the compiler before each file in traversal order
+	void advance();
+protected:
+	void _run();
+	
+	// Returns false when stopped
+	bool _prefetchDir(FrozenModDir const& dir);
+	bool _waitForTurn();
+protected:
+	FrozenModDirectory const& m_files;
+	size_t m_distance;
+	Filter m_filter;
+	
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	size_t m_consumed;      // files the compiler has started with
+	size_t m_issued;        // files the thread has prefetched
+	bool m_stop;
+	
+	std::thread m_thread;
+};
+
+}
+
+#endif
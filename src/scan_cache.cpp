@@ -0,0 +1,276 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "scan_cache.h"
+#include "filename_utils.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace tlmodder {
+
+namespace {
+
+// Snapshot layout, all numbers in native byte order:
+//   magic, root path length (u32), root path, number of directories (u32)
+//   for each directory:
+//     path length (u32), path relative to root, mtime (i64), inode (u64),
+//     listing length (u32), listing (see ScanCache::Listing)
+const char SNAPSHOT_MAGIC[8] = {'T', 'L', 'M', 'S', 'C', 'A', 'N', '1'};
+
+// Directories modified this close to the scan may change again within the
+// same mtime tick, they are stored so that they are read again next time
+const int64_t RACY_MTIME_NS = 2000000000;
+
+const int64_t INVALID_MTIME = INT64_MIN;
+
+inline int64_t mtimeNs(struct stat const& st)
+{
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Bounds-checked reading of the mapped snapshot
+class SnapshotReader
+{
+public:
+	SnapshotReader(uint8_t const* ptr, size_t size):
+		m_cur((char const*)ptr), m_end((char const*)ptr + size)
+	{}
+	
+	template<typename T>
+	bool read(T& value)
+	{
+		if ((size_t)(m_end - m_cur) < sizeof(T))
+			return false;
+		
+		std::memcpy(&value, m_cur, sizeof(T));
+		m_cur += sizeof(T);
+		return true;
+	}
+	
+	bool read(char const*& data, uint32_t size)
+	{
+		if ((size_t)(m_end - m_cur) < size)
+			return false;
+		
+		data = m_cur;
+		m_cur += size;
+		return true;
+	}
+	
+	bool atEnd() const
+	{ return m_cur == m_end; }
+protected:
+	char const* m_cur;
+	char const* m_end;
+};
+
+// FNV-1a, names the snapshot file after the root path
+uint64_t hashPath(string const& path)
+{
+	uint64_t hash = 14695981039346656037ull;
+	
+	for (char c : path)
+	{
+		hash ^= (uint8_t)c;
+		hash *= 1099511628211ull;
+	}
+	
+	return hash;
+}
+
+template<typename T>
+void writeValue(std::ofstream& strm, T value)
+{
+	strm.write((char const*)&value, sizeof(value));
+}
+
+}
+
+
+void ScanCache::Listing::add(string const& fn, DirIterator::EntryType type)
+{
+	// File names are at most NAME_MAX (255) bytes long
+	m_data.push_back((char)type);
+	m_data.push_back((char)(uint8_t)fn.size());
+	m_data.append(fn, 0, (uint8_t)fn.size());
+}
+
+bool ScanCache::Listing::next(string& fn, DirIterator::EntryType& type)
+{
+	if (m_pos + 2 > m_data.size())
+		return false;
+	
+	size_t len = (uint8_t)m_data[m_pos + 1];
+	
+	type = (DirIterator::EntryType)m_data[m_pos];
+	fn.assign(m_data, m_pos + 2, len);
+	m_pos += 2 + len;
+	
+	return true;
+}
+
+
+ScanCache::ScanCache(string const& cacheDir, string const& rootPath):
+	m_cacheDir(cacheDir),
+	m_changed(false)
+{
+	struct timespec now;
+	char hashStr[17];
+	char* realPath;
+	
+	::clock_gettime(CLOCK_REALTIME, &now);
+	m_started = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	
+	// Snapshot is keyed by canonical path, so the same mod reached by
+	// different relative paths shares one snapshot
+	if ((realPath = ::realpath(rootPath.c_str(), nullptr)) == nullptr)
+		return;
+	
+	m_rootPath = realPath;
+	::free(realPath);
+	
+	::snprintf(hashStr, sizeof(hashStr), "%016llx", (unsigned long long)hashPath(m_rootPath));
+	m_file = FileName::build(m_cacheDir, string(hashStr) + ".scan");
+	
+	try {
+		_load();
+	}
+	catch (MappedFile::MappingFailed&)
+	{
+		// No snapshot yet
+		m_snapshot.reset();
+		m_records.clear();
+	}
+}
+
+void ScanCache::_load()
+{
+	char magic[sizeof(SNAPSHOT_MAGIC)];
+	uint32_t rootLen, numDirs, len;
+	char const* data;
+	
+	m_snapshot.reset(new MappedFile(m_file, MappedFile::POPULATE));
+	
+	SnapshotReader reader(m_snapshot->ptr(), m_snapshot->size());
+	
+	if (!reader.read(magic) || std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 ||
+	    !reader.read(rootLen) || !reader.read(data, rootLen) ||
+	    string(data, rootLen) != m_rootPath || !reader.read(numDirs))
+		throw MappedFile::MappingFailed("foreign snapshot");
+	
+	m_records.reserve(numDirs);
+	
+	for (uint32_t i = 0; i < numDirs; ++i)
+	{
+		Record record;
+		
+		if (!reader.read(len) || !reader.read(data, len))
+			throw MappedFile::MappingFailed("corrupted snapshot");
+		
+		string relativeDir(data, len);
+		
+		if (!reader.read(record.mtime) || !reader.read(record.ino) ||
+		    !reader.read(record.size) || !reader.read(record.data, record.size))
+			throw MappedFile::MappingFailed("corrupted snapshot");
+		
+		m_records.insert(std::make_pair(std::move(relativeDir), record));
+	}
+	
+	if (!reader.atEnd())
+		throw MappedFile::MappingFailed("corrupted snapshot");
+}
+
+bool ScanCache::find(string const& relativeDir, struct stat const& st, Listing& listing) const
+{
+	auto it = m_records.find(relativeDir);
+	
+	if (it == m_records.end() || it->second.mtime != mtimeNs(st) || it->second.ino != (uint64_t)st.st_ino)
+		return false;
+	
+	listing.m_data.assign(it->second.data, it->second.size);
+	listing.m_pos = 0;
+	listing.m_fromSnapshot = true;
+	
+	return true;
+}
+
+void ScanCache::store(string const& relativeDir, struct stat const& st, Listing&& listing)
+{
+	NewRecord record{relativeDir, mtimeNs(st), (uint64_t)st.st_ino, std::move(listing.m_data)};
+	bool changed = !listing.m_fromSnapshot;
+	
+	if (record.mtime >= m_started - RACY_MTIME_NS)
+	{
+		record.mtime = INVALID_MTIME;
+		changed = true;
+	}
+	
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	m_newRecords.push_back(std::move(record));
+	m_changed = m_changed || changed;
+}
+
+void ScanCache::save()
+{
+	std::ofstream strm;
+	string tmpFile;
+	
+	// Removed directories are not stored again, all other are taken from snapshot
+	if (m_file.empty() || (!m_changed && m_newRecords.size() == m_records.size()))
+		return;
+	
+	if (::mkdir(m_cacheDir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP) != 0 && errno != EEXIST)
+	{
+		std::cerr << "WARNING: could not create scan cache directory " << m_cacheDir << std::endl;
+		return;
+	}
+	
+	std::sort(m_newRecords.begin(), m_newRecords.end(), [](NewRecord const& r1, NewRecord const& r2)
+	{ return r1.relativeDir < r2.relativeDir; });
+	
+	// Written under temporary name, so that interrupted run doesn't leave half of a snapshot
+	tmpFile = m_file + ".tmp";
+	strm.open(tmpFile, std::ios::binary | std::ios::trunc);
+	
+	strm.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	writeValue(strm, (uint32_t)m_rootPath.size());
+	strm.write(m_rootPath.data(), m_rootPath.size());
+	writeValue(strm, (uint32_t)m_newRecords.size());
+	
+	for (NewRecord const& record : m_newRecords)
+	{
+		writeValue(strm, (uint32_t)record.relativeDir.size());
+		strm.write(record.relativeDir.data(), record.relativeDir.size());
+		writeValue(strm, record.mtime);
+		writeValue(strm, record.ino);
+		writeValue(strm, (uint32_t)record.data.size());
+		strm.write(record.data.data(), record.data.size());
+	}
+	
+	strm.close();
+	
+	if (strm.fail() || ::rename(tmpFile.c_str(), m_file.c_str()) != 0)
+	{
+		std::cerr << "WARNING: could not write scan cache " << m_file << std::endl;
+		::unlink(tmpFile.c_str());
+	}
+}
+
+}
@@ -0,0 +1,110 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_SCAN_CACHE_H__
+#define __TLMODDER_SCAN_CACHE_H__
+
+#include "dir_iterator.h"
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tlmodder {
+
+using std::string;
+
+// Snapshot of directory listings of one mod root, kept between runs
+// Each directory is stored with its mtime and inode number. When both still
+// match, its listing is taken from the snapshot instead of reading the
+// directory, so an unchanged tree costs one stat() per directory. Directory
+// mtime changes only when its own entries change, so changed directories are
+// found one by one and only they are read again.
+// The snapshot is loaded with a single mmap and rewritten by save() only if
+// some directory was read from disk.
+class ScanCache
+{
+public:
+	// Entries of one directory, encoded as they are stored in the snapshot
+	class Listing
+	{
+	public:
+		Listing():
+			m_pos(0), m_fromSnapshot(false)
+		{}
+		
+		void add(string const& fn, DirIterator::EntryType type);
+		
+		// Returns entries in order they were added
+		bool next(string& fn, DirIterator::EntryType& type);
+	protected:
+		string m_data;        // type byte, name length byte and name of each entry
+		size_t m_pos;
+		bool m_fromSnapshot;
+		
+		friend class ScanCache;
+	};
+	
+	// Loads snapshot of rootPath from cacheDir, missing, foreign or corrupted
+	// snapshot is treated as empty
+	ScanCache(string const& cacheDir, string const& rootPath);
+	
+	ScanCache(ScanCache const&) = delete;
+	ScanCache& operator=(ScanCache const&) = delete;
+	
+	// Fills listing of directory relativeDir from the snapshot if the directory,
+	// whose current status is st, is unchanged. May be called from multiple threads.
+	bool find(string const& relativeDir, struct stat const& st, Listing& listing) const;
+	
+	// Puts listing of directory into the new snapshot. May be called from multiple threads.
+	void store(string const& relativeDir, struct stat const& st, Listing&& listing);
+	
+	// Writes the new snapshot if it differs from the loaded one
+	// Failure is reported as a warning, it only means the next run scans again.
+	void save();
+protected:
+	struct Record
+	{
+		int64_t mtime;
+		uint64_t ino;
+		char const* data;     // listing in the mapped snapshot
+		uint32_t size;
+	};
+	
+	struct NewRecord
+	{
+		string relativeDir;
+		int64_t mtime;
+		uint64_t ino;
+		string data;
+	};
+	
+	void _load();
+protected:
+	string m_cacheDir;
+	string m_file;                    // empty if the root doesn't exist
+	string m_rootPath;                // canonical path of the root
+	int64_t m_started;                // time when the cache was created, see store()
+	
+	std::unique_ptr<MappedFile> m_snapshot;
+	std::unordered_map<string, Record> m_records;
+	
+	std::mutex m_mutex;
+	std::vector<NewRecord> m_newRecords;
+	bool m_changed;
+};
+
+}
+
+#endif
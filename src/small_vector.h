@@ -0,0 +1,156 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_SMALL_VECTOR_H__
+#define __TLMODDER_SMALL_VECTOR_H__
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+namespace tlmodder {
+
+// Vector which keeps up to N elements inline and allocates only when it grows
+// beyond that. Elements are moved with memcpy, so T must be trivially copyable.
+template<typename T, size_t N>
+class SmallVector
+{
+	static_assert(std::is_trivial<T>::value, "SmallVector element must be trivial");
+public:
+	SmallVector():
+		m_size(0), m_capacity(N)
+	{}
+	
+	SmallVector(SmallVector const& other):
+		m_size(0), m_capacity(N)
+	{ insert(end(), other.begin(), other.end()); }
+	
+	SmallVector(SmallVector&& other):
+		m_size(other.m_size), m_capacity(other.m_capacity)
+	{
+		std::memcpy(&m_storage, &other.m_storage, sizeof(m_storage));
+		other.m_size = 0;
+		other.m_capacity = N;
+	}
+	
+	~SmallVector()
+	{
+		if (_isHeap())
+			std::free(m_storage.heap);
+	}
+	
+	SmallVector& operator=(SmallVector const& other)
+	{
+		if (this != &other)
+		{
+			clear();
+			insert(end(), other.begin(), other.end());
+		}
+		return *this;
+	}
+	
+	SmallVector& operator=(SmallVector&& other)
+	{
+		if (this != &other)
+		{
+			if (_isHeap())
+				std::free(m_storage.heap);
+			
+			m_size = other.m_size;
+			m_capacity = other.m_capacity;
+			std::memcpy(&m_storage, &other.m_storage, sizeof(m_storage));
+			other.m_size = 0;
+			other.m_capacity = N;
+		}
+		return *this;
+	}
+	
+	T* data()
+	{ return _isHeap() ? m_storage.heap : m_storage.inlined; }
+	
+	T const* data() const
+	{ return _isHeap() ? m_storage.heap : m_storage.inlined; }
+	
+	size_t size() const
+	{ return m_size; }
+	
+	bool empty() const
+	{ return m_size == 0; }
+	
+	T* begin()             { return data(); }
+	T* end()               { return data() + m_size; }
+	T const* begin() const { return data(); }
+	T const* end() const   { return data() + m_size; }
+	
+	T& front()             { return data()[0]; }
+	T const& front() const { return data()[0]; }
+	
+	T& operator[](size_t i)             { return data()[i]; }
+	T const& operator[](size_t i) const { return data()[i]; }
+	
+	void clear()
+	{ m_size = 0; }
+	
+	void push_back(T const& value)
+	{ insert(end(), &value, &value + 1); }
+	
+	// Inserts [first, last) before pos, the range must not point into this vector
+	T* insert(T* pos, T const* first, T const* last)
+	{
+		size_t index = pos - data();
+		size_t count = last - first;
+		
+		if (m_size + count > m_capacity)
+			_grow(m_size + count);
+		
+		T* ptr = data() + index;
+		std::memmove(ptr + count, ptr, (m_size - index) * sizeof(T));
+		std::memcpy(ptr, first, count * sizeof(T));
+		m_size += (uint32_t)count;
+		
+		return ptr;
+	}
+protected:
+	bool _isHeap() const
+	{ return m_capacity > N; }
+	
+	void _grow(size_t minCapacity)
+	{
+		size_t capacity = m_capacity * 2;
+		T* heap;
+		
+		if (capacity < minCapacity)
+			capacity = minCapacity;
+		
+		if ((heap = (T*)std::malloc(capacity * sizeof(T))) == nullptr)
+			throw std::bad_alloc();
+		
+		std::memcpy(heap, data(), m_size * sizeof(T));
+		
+		if (_isHeap())
+			std::free(m_storage.heap);
+		
+		m_storage.heap = heap;
+		m_capacity = (uint32_t)capacity;
+	}
+protected:
+	uint32_t m_size;
+	uint32_t m_capacity;    // N while elements are inline
+	
+	union
+	{
+		T* heap;
+		T inlined[N];
+	} m_storage;
+};
+
+}
+
+#endif
@@ -0,0 +1,83 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_STRING_REF_H__
+#define __TLMODDER_STRING_REF_H__
+
+#include <cstring>
+#include <string>
+
+namespace tlmodder {
+
+using std::string;
+
+// Non-owning reference to a sequence of characters, used where a function
+// should accept both std::string and a part of some buffer without making
+// a copy. Referenced data must outlive the StringRef.
+class StringRef
+{
+public:
+	StringRef():
+		m_data(""), m_size(0)
+	{}
+	
+	StringRef(char const* data, size_t size):
+		m_data(data), m_size(size)
+	{}
+	
+	StringRef(char const* str):
+		m_data(str), m_size(std::strlen(str))
+	{}
+	
+	StringRef(string const& str):
+		m_data(str.data()), m_size(str.size())
+	{}
+	
+	char const* data() const
+	{ return m_data; }
+	
+	size_t size() const
+	{ return m_size; }
+	
+	bool empty() const
+	{ return m_size == 0; }
+	
+	char const* begin() const
+	{ return m_data; }
+	
+	char const* end() const
+	{ return m_data + m_size; }
+	
+	char operator[](size_t i) const
+	{ return m_data[i]; }
+	
+	StringRef substr(size_t pos, size_t len = string::npos) const
+	{
+		if (pos > m_size)
+			pos = m_size;
+		if (len > m_size - pos)
+			len = m_size - pos;
+		return StringRef(m_data + pos, len);
+	}
+	
+	string str() const
+	{ return string(m_data, m_size); }
+	
+	bool operator==(StringRef const& other) const
+	{ return m_size == other.m_size && std::memcmp(m_data, other.m_data, m_size) == 0; }
+	
+	bool operator!=(StringRef const& other) const
+	{ return !(*this == other); }
+protected:
+	char const* m_data;
+	size_t m_size;
+};
+
+}
+
+#endif
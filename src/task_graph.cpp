@@ -0,0 +1,95 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#include "task_graph.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace tlmodder {
+
+size_t TaskGraph::add(Task task)
+{
+	m_tasks.push_back(Node{std::move(task), 0, {}});
+	return m_tasks.size() - 1;
+}
+
+void TaskGraph::addDependency(size_t task, size_t dependency)
+{
+	m_tasks[dependency].dependents.push_back(task);
+	++m_tasks[task].numPending;
+}
+
+void TaskGraph::run(unsigned numThreads)
+{
+	std::vector<std::thread> workers;
+	std::deque<size_t> ready;
+	std::mutex mutex;
+	std::condition_variable cond;
+	size_t numRunning = 0, numDone = 0;
+	
+	for (size_t i = 0; i < m_tasks.size(); ++i)
+	{
+		if (m_tasks[i].numPending == 0)
+			ready.push_back(i);
+	}
+	
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	
+	auto worker = [&]()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		
+		for (;;)
+		{
+			// Running tasks may still make others ready
+			while (ready.empty() && numRunning != 0)
+				cond.wait(lock);
+			
+			if (ready.empty())
+				return;
+			
+			size_t i = ready.front();
+			ready.pop_front();
+			++numRunning;
+			
+			lock.unlock();
+			m_tasks[i].task();
+			lock.lock();
+			
+			--numRunning;
+			++numDone;
+			
+			for (size_t dependent : m_tasks[i].dependents)
+			{
+				if (--m_tasks[dependent].numPending == 0)
+					ready.push_back(dependent);
+			}
+			
+			cond.notify_all();
+		}
+	};
+	
+	for (unsigned i = 1; i < numThreads; ++i)
+		workers.emplace_back(worker);
+	
+	worker();
+	
+	for (std::thread& thread : workers)
+		thread.join();
+	
+	if (numDone != m_tasks.size())
+		throw std::logic_error("Tasks depend on each other in a cycle");
+}
+
+}
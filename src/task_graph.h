@@ -0,0 +1,53 @@
+/* 
+ * This program is free software. It comes without any warranty, to
+ * the extent permitted by applicable law. You can redistribute it
+ * and/or modify it under the terms of the Do What The Fuck You Want
+ * To Public License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details.
+ */ 
+
+#ifndef __TLMODDER_TASK_GRAPH_H__
+#define __TLMODDER_TASK_GRAPH_H__
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace tlmodder {
+
+// Tasks with dependencies between them, run on multiple threads
+// A task is started as soon as all tasks it depends on are done, tasks are
+// started in order they became ready.
+class TaskGraph
+{
+public:
+	using Task = std::function<void()>;
+	
+	// Returns id of the task
+	size_t add(Task task);
+	
+	// Task won't be started before 'dependency' is done
+	void addDependency(size_t task, size_t dependency);
+	
+	size_t size() const
+	{ return m_tasks.size(); }
+	
+	// Runs all tasks on numThreads threads, the calling thread included, 0
+	// means number of CPUs. Tasks must not throw.
+	// Throws std::logic_error if some tasks depend on each other in a cycle,
+	// tasks outside of it are run anyway.
+	void run(unsigned numThreads);
+protected:
+	struct Node
+	{
+		Task task;
+		size_t numPending;                // dependencies which aren't done yet
+		std::vector<size_t> dependents;
+	};
+protected:
+	std::vector<Node> m_tasks;
+};
+
+}
+
+#endif
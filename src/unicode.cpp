@@ -8,56 +8,67 @@
 
 #include "unicode.h"
 
-namespace tlmodder
-{
+#include <algorithm>
+#include <cstring>
 
-static const uint8_t utf8_len_table[256] = {
-/*   0 -  31 */ 1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-/*  32 -  63 */ 1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-/*  64 -  95 */ 1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-/*  96 - 127 */ 1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,
-/* 128 - 159 */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-/* 160 - 191 */ 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
-/* 192 - 223 */ 2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,
-/* 224 - 255 */ 3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,4,4,4,4,4,4,4,4,5,5,5,5,6,6,0,0
-};
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-static const uint8_t utf8_mask_table[7] = {
-	0x00, 0x7f, 0x1f, 0x0f, 0x07, 0x03, 0x01
-};
+namespace tlmodder
+{
 
-bool utf8_iterator::next(char32_t& chr_out)
+UnicodeEncoding detect_encoding(uint8_t const* data, size_t size, size_t& bom_size)
 {
-	uint8_t c;
-	uint8_t tableLen;
-	uint8_t mask;
-	char const* end;
-	
-	if (m_cur == m_end)
-		return false;
-	
-	c = (uint8_t)*m_cur;
-	tableLen = utf8_len_table[c];
-	mask = utf8_mask_table[tableLen];
-	
-	for (end = m_cur+1; end != m_end && ((uint8_t)*end & 0xc0) == 0x80; ++end);
-	
-	if (end - m_cur != tableLen)
+	// Detect encoding based on BOM, if present
+	// UTF-32LE BOM starts with UTF-16LE one, so it must be checked first
+	if (size > 2 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf)
 	{
-		// FIXME: maybe fall here for tableLen > 4 too, since it was deprecated
-		chr_out = 0xfffdu;
+		bom_size = 3;
+		return UnicodeEncoding::UTF_8;
 	}
-	else
+	else if (size > 3 && data[0] == 0x00 && data[1] == 0x00 && data[2] == 0xfe && data[3] == 0xff)
 	{
-		chr_out = c & mask;
-		for (uint8_t i = 1; i < tableLen; ++i)
-		{
-			chr_out = (chr_out << 6) | ((uint8_t)m_cur[i] & 0xc0);
-		}
+		bom_size = 4;
+		return UnicodeEncoding::UTF_32BE;
+	}
+	else if (size > 3 && data[0] == 0xff && data[1] == 0xfe && data[2] == 0x00 && data[3] == 0x00)
+	{
+		bom_size = 4;
+		return UnicodeEncoding::UTF_32LE;
+	}
+	else if (size > 1 && data[0] == 0xfe && data[1] == 0xff)
+	{
+		bom_size = 2;
+		return UnicodeEncoding::UTF_16BE;
+	}
+	else if (size > 1 && data[0] == 0xff && data[1] == 0xfe)
+	{
+		bom_size = 2;
+		return UnicodeEncoding::UTF_16LE;
 	}
 	
-	m_cur = end;
-	return true;
+	bom_size = 0;
+	
+	// No BOM, try to guess based on file content
+	// Since valid DAT files should start with ASCII character, we
+	// can guess by looking for zero bytes around it: three at #0-#2 (UTF-32BE),
+	// at #1-#3 (UTF-32LE), one at #0 (UTF-16BE) or #1 (UTF-16LE)
+	// if we don't find them, assume UTF-8
+	
+	// NOTE: should one want to default to something else, here is the right place
+	//       to do it
+	
+	if (size > 3 && data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x00)
+		return UnicodeEncoding::UTF_32BE;
+	else if (size > 3 && data[1] == 0x00 && data[2] == 0x00 && data[3] == 0x00)
+		return UnicodeEncoding::UTF_32LE;
+	else if (size > 1 && data[0] == 0x00)
+		return UnicodeEncoding::UTF_16BE;
+	else if (size > 1 && data[1] == 0x00)
+		return UnicodeEncoding::UTF_16LE;
+	
+	return UnicodeEncoding::UTF_8;
 }
 
 size_t utf32chr_to_utf8(char32_t c, char *buf)
@@ -130,4 +141,508 @@ string utf16_to_utf8(char16_t const* utf16str, size_t size)
 	return std::move(result);
 }
 
+
+// ~~ Case mapping ~~
+
+namespace
+{
+
+struct upper_range
+{
+	uint32_t first;
+	uint32_t last;
+	int32_t  delta;
+	uint32_t stride; // 1 - every character in range maps, 2 - every other one
+};
+
+// Simple upper-case mappings of non-ASCII characters (Unicode 14.0), with
+// runs sharing the same delta merged into ranges
+const upper_range upper_ranges[] = {
+	{ 0x000b5, 0x000b5,    743, 1 },
+	{ 0x000e0, 0x000f6,    -32, 1 },
+	{ 0x000f8, 0x000fe,    -32, 1 },
+	{ 0x000ff, 0x000ff,    121, 1 },
+	{ 0x00101, 0x0012f,     -1, 2 },
+	{ 0x00131, 0x00131,   -232, 1 },
+	{ 0x00133, 0x00137,     -1, 2 },
+	{ 0x0013a, 0x00148,     -1, 2 },
+	{ 0x0014b, 0x00177,     -1, 2 },
+	{ 0x0017a, 0x0017e,     -1, 2 },
+	{ 0x0017f, 0x0017f,   -300, 1 },
+	{ 0x00180, 0x00180,    195, 1 },
+	{ 0x00183, 0x00185,     -1, 2 },
+	{ 0x00188, 0x00188,     -1, 1 },
+	{ 0x0018c, 0x0018c,     -1, 1 },
+	{ 0x00192, 0x00192,     -1, 1 },
+	{ 0x00195, 0x00195,     97, 1 },
+	{ 0x00199, 0x00199,     -1, 1 },
+	{ 0x0019a, 0x0019a,    163, 1 },
+	{ 0x0019e, 0x0019e,    130, 1 },
+	{ 0x001a1, 0x001a5,     -1, 2 },
+	{ 0x001a8, 0x001a8,     -1, 1 },
+	{ 0x001ad, 0x001ad,     -1, 1 },
+	{ 0x001b0, 0x001b0,     -1, 1 },
+	{ 0x001b4, 0x001b6,     -1, 2 },
+	{ 0x001b9, 0x001b9,     -1, 1 },
+	{ 0x001bd, 0x001bd,     -1, 1 },
+	{ 0x001bf, 0x001bf,     56, 1 },
+	{ 0x001c5, 0x001c5,     -1, 1 },
+	{ 0x001c6, 0x001c6,     -2, 1 },
+	{ 0x001c8, 0x001c8,     -1, 1 },
+	{ 0x001c9, 0x001c9,     -2, 1 },
+	{ 0x001cb, 0x001cb,     -1, 1 },
+	{ 0x001cc, 0x001cc,     -2, 1 },
+	{ 0x001ce, 0x001dc,     -1, 2 },
+	{ 0x001dd, 0x001dd,    -79, 1 },
+	{ 0x001df, 0x001ef,     -1, 2 },
+	{ 0x001f2, 0x001f2,     -1, 1 },
+	{ 0x001f3, 0x001f3,     -2, 1 },
+	{ 0x001f5, 0x001f5,     -1, 1 },
+	{ 0x001f9, 0x0021f,     -1, 2 },
+	{ 0x00223, 0x00233,     -1, 2 },
+	{ 0x0023c, 0x0023c,     -1, 1 },
+	{ 0x0023f, 0x00240,  10815, 1 },
+	{ 0x00242, 0x00242,     -1, 1 },
+	{ 0x00247, 0x0024f,     -1, 2 },
+	{ 0x00250, 0x00250,  10783, 1 },
+	{ 0x00251, 0x00251,  10780, 1 },
+	{ 0x00252, 0x00252,  10782, 1 },
+	{ 0x00253, 0x00253,   -210, 1 },
+	{ 0x00254, 0x00254,   -206, 1 },
+	{ 0x00256, 0x00257,   -205, 1 },
+	{ 0x00259, 0x00259,   -202, 1 },
+	{ 0x0025b, 0x0025b,   -203, 1 },
+	{ 0x0025c, 0x0025c,  42319, 1 },
+	{ 0x00260, 0x00260,   -205, 1 },
+	{ 0x00261, 0x00261,  42315, 1 },
+	{ 0x00263, 0x00263,   -207, 1 },
+	{ 0x00265, 0x00265,  42280, 1 },
+	{ 0x00266, 0x00266,  42308, 1 },
+	{ 0x00268, 0x00268,   -209, 1 },
+	{ 0x00269, 0x00269,   -211, 1 },
+	{ 0x0026a, 0x0026a,  42308, 1 },
+	{ 0x0026b, 0x0026b,  10743, 1 },
+	{ 0x0026c, 0x0026c,  42305, 1 },
+	{ 0x0026f, 0x0026f,   -211, 1 },
+	{ 0x00271, 0x00271,  10749, 1 },
+	{ 0x00272, 0x00272,   -213, 1 },
+	{ 0x00275, 0x00275,   -214, 1 },
+	{ 0x0027d, 0x0027d,  10727, 1 },
+	{ 0x00280, 0x00280,   -218, 1 },
+	{ 0x00282, 0x00282,  42307, 1 },
+	{ 0x00283, 0x00283,   -218, 1 },
+	{ 0x00287, 0x00287,  42282, 1 },
+	{ 0x00288, 0x00288,   -218, 1 },
+	{ 0x00289, 0x00289,    -69, 1 },
+	{ 0x0028a, 0x0028b,   -217, 1 },
+	{ 0x0028c, 0x0028c,    -71, 1 },
+	{ 0x00292, 0x00292,   -219, 1 },
+	{ 0x0029d, 0x0029d,  42261, 1 },
+	{ 0x0029e, 0x0029e,  42258, 1 },
+	{ 0x00345, 0x00345,     84, 1 },
+	{ 0x00371, 0x00373,     -1, 2 },
+	{ 0x00377, 0x00377,     -1, 1 },
+	{ 0x0037b, 0x0037d,    130, 1 },
+	{ 0x003ac, 0x003ac,    -38, 1 },
+	{ 0x003ad, 0x003af,    -37, 1 },
+	{ 0x003b1, 0x003c1,    -32, 1 },
+	{ 0x003c2, 0x003c2,    -31, 1 },
+	{ 0x003c3, 0x003cb,    -32, 1 },
+	{ 0x003cc, 0x003cc,    -64, 1 },
+	{ 0x003cd, 0x003ce,    -63, 1 },
+	{ 0x003d0, 0x003d0,    -62, 1 },
+	{ 0x003d1, 0x003d1,    -57, 1 },
+	{ 0x003d5, 0x003d5,    -47, 1 },
+	{ 0x003d6, 0x003d6,    -54, 1 },
+	{ 0x003d7, 0x003d7,     -8, 1 },
+	{ 0x003d9, 0x003ef,     -1, 2 },
+	{ 0x003f0, 0x003f0,    -86, 1 },
+	{ 0x003f1, 0x003f1,    -80, 1 },
+	{ 0x003f2, 0x003f2,      7, 1 },
+	{ 0x003f3, 0x003f3,   -116, 1 },
+	{ 0x003f5, 0x003f5,    -96, 1 },
+	{ 0x003f8, 0x003f8,     -1, 1 },
+	{ 0x003fb, 0x003fb,     -1, 1 },
+	{ 0x00430, 0x0044f,    -32, 1 },
+	{ 0x00450, 0x0045f,    -80, 1 },
+	{ 0x00461, 0x00481,     -1, 2 },
+	{ 0x0048b, 0x004bf,     -1, 2 },
+	{ 0x004c2, 0x004ce,     -1, 2 },
+	{ 0x004cf, 0x004cf,    -15, 1 },
+	{ 0x004d1, 0x0052f,     -1, 2 },
+	{ 0x00561, 0x00586,    -48, 1 },
+	{ 0x010d0, 0x010fa,   3008, 1 },
+	{ 0x010fd, 0x010ff,   3008, 1 },
+	{ 0x013f8, 0x013fd,     -8, 1 },
+	{ 0x01c80, 0x01c80,  -6254, 1 },
+	{ 0x01c81, 0x01c81,  -6253, 1 },
+	{ 0x01c82, 0x01c82,  -6244, 1 },
+	{ 0x01c83, 0x01c84,  -6242, 1 },
+	{ 0x01c85, 0x01c85,  -6243, 1 },
+	{ 0x01c86, 0x01c86,  -6236, 1 },
+	{ 0x01c87, 0x01c87,  -6181, 1 },
+	{ 0x01c88, 0x01c88,  35266, 1 },
+	{ 0x01d79, 0x01d79,  35332, 1 },
+	{ 0x01d7d, 0x01d7d,   3814, 1 },
+	{ 0x01d8e, 0x01d8e,  35384, 1 },
+	{ 0x01e01, 0x01e95,     -1, 2 },
+	{ 0x01e9b, 0x01e9b,    -59, 1 },
+	{ 0x01ea1, 0x01eff,     -1, 2 },
+	{ 0x01f00, 0x01f07,      8, 1 },
+	{ 0x01f10, 0x01f15,      8, 1 },
+	{ 0x01f20, 0x01f27,      8, 1 },
+	{ 0x01f30, 0x01f37,      8, 1 },
+	{ 0x01f40, 0x01f45,      8, 1 },
+	{ 0x01f51, 0x01f57,      8, 2 },
+	{ 0x01f60, 0x01f67,      8, 1 },
+	{ 0x01f70, 0x01f71,     74, 1 },
+	{ 0x01f72, 0x01f75,     86, 1 },
+	{ 0x01f76, 0x01f77,    100, 1 },
+	{ 0x01f78, 0x01f79,    128, 1 },
+	{ 0x01f7a, 0x01f7b,    112, 1 },
+	{ 0x01f7c, 0x01f7d,    126, 1 },
+	{ 0x01f80, 0x01f87,      8, 1 },
+	{ 0x01f90, 0x01f97,      8, 1 },
+	{ 0x01fa0, 0x01fa7,      8, 1 },
+	{ 0x01fb0, 0x01fb1,      8, 1 },
+	{ 0x01fb3, 0x01fb3,      9, 1 },
+	{ 0x01fbe, 0x01fbe,  -7205, 1 },
+	{ 0x01fc3, 0x01fc3,      9, 1 },
+	{ 0x01fd0, 0x01fd1,      8, 1 },
+	{ 0x01fe0, 0x01fe1,      8, 1 },
+	{ 0x01fe5, 0x01fe5,      7, 1 },
+	{ 0x01ff3, 0x01ff3,      9, 1 },
+	{ 0x0214e, 0x0214e,    -28, 1 },
+	{ 0x02170, 0x0217f,    -16, 1 },
+	{ 0x02184, 0x02184,     -1, 1 },
+	{ 0x024d0, 0x024e9,    -26, 1 },
+	{ 0x02c30, 0x02c5f,    -48, 1 },
+	{ 0x02c61, 0x02c61,     -1, 1 },
+	{ 0x02c65, 0x02c65, -10795, 1 },
+	{ 0x02c66, 0x02c66, -10792, 1 },
+	{ 0x02c68, 0x02c6c,     -1, 2 },
+	{ 0x02c73, 0x02c73,     -1, 1 },
+	{ 0x02c76, 0x02c76,     -1, 1 },
+	{ 0x02c81, 0x02ce3,     -1, 2 },
+	{ 0x02cec, 0x02cee,     -1, 2 },
+	{ 0x02cf3, 0x02cf3,     -1, 1 },
+	{ 0x02d00, 0x02d25,  -7264, 1 },
+	{ 0x02d27, 0x02d27,  -7264, 1 },
+	{ 0x02d2d, 0x02d2d,  -7264, 1 },
+	{ 0x0a641, 0x0a66d,     -1, 2 },
+	{ 0x0a681, 0x0a69b,     -1, 2 },
+	{ 0x0a723, 0x0a72f,     -1, 2 },
+	{ 0x0a733, 0x0a76f,     -1, 2 },
+	{ 0x0a77a, 0x0a77c,     -1, 2 },
+	{ 0x0a77f, 0x0a787,     -1, 2 },
+	{ 0x0a78c, 0x0a78c,     -1, 1 },
+	{ 0x0a791, 0x0a793,     -1, 2 },
+	{ 0x0a794, 0x0a794,     48, 1 },
+	{ 0x0a797, 0x0a7a9,     -1, 2 },
+	{ 0x0a7b5, 0x0a7c3,     -1, 2 },
+	{ 0x0a7c8, 0x0a7ca,     -1, 2 },
+	{ 0x0a7d1, 0x0a7d1,     -1, 1 },
+	{ 0x0a7d7, 0x0a7d9,     -1, 2 },
+	{ 0x0a7f6, 0x0a7f6,     -1, 1 },
+	{ 0x0ab53, 0x0ab53,   -928, 1 },
+	{ 0x0ab70, 0x0abbf, -38864, 1 },
+	{ 0x0ff41, 0x0ff5a,    -32, 1 },
+	{ 0x10428, 0x1044f,    -40, 1 },
+	{ 0x104d8, 0x104fb,    -40, 1 },
+	{ 0x10597, 0x105a1,    -39, 1 },
+	{ 0x105a3, 0x105b1,    -39, 1 },
+	{ 0x105b3, 0x105b9,    -39, 1 },
+	{ 0x105bb, 0x105bc,    -39, 1 },
+	{ 0x10cc0, 0x10cf2,    -64, 1 },
+	{ 0x118c0, 0x118df,    -32, 1 },
+	{ 0x16e60, 0x16e7f,    -32, 1 },
+	{ 0x1e922, 0x1e943,    -34, 1 },
+};
+
+const uint64_t ascii_ones = UINT64_C(0x0101010101010101);
+const uint64_t ascii_high = UINT64_C(0x8080808080808080);
+
+// Upper-cases 8 ASCII characters at once. All bytes must be below 0x80, so
+// the additions cannot carry into the neighbouring byte.
+inline uint64_t ascii_upper_word(uint64_t w)
+{
+	uint64_t ge_a = w + ascii_ones * (0x80 - 'a');
+	uint64_t gt_z = w + ascii_ones * (0x80 - 'z' - 1);
+	return w ^ (((ge_a & ~gt_z) & ascii_high) >> 2);
+}
+
+inline char ascii_upper(char c)
+{ return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c; }
+
+// Upper-cases the leading ASCII run of str into out (which may be equal to
+// str), returns its length
+size_t ascii_upper_run(char const* str, size_t len, char* out)
+{
+	size_t i = 0;
+	uint64_t w;
+	
+	for (; i + 8 <= len; i += 8)
+	{
+		std::memcpy(&w, str + i, 8);
+		if (w & ascii_high)
+			break;
+		w = ascii_upper_word(w);
+		std::memcpy(out + i, &w, 8);
+	}
+	
+	for (; i < len && !((uint8_t)str[i] & 0x80u); ++i)
+		out[i] = ascii_upper(str[i]);
+	
+	return i;
+}
+
+// Reads one character at pos for case-insensitive comparison, invalid bytes
+// are ordered after U+10FFFF
+uint32_t nocase_key(char const* str, size_t len, size_t& pos)
+{
+	uint8_t b = (uint8_t)str[pos];
+	char32_t c;
+	size_t n;
+	
+	if (b < 0x80u)
+	{
+		++pos;
+		return (uint8_t)ascii_upper((char)b);
+	}
+	
+	n = utf8_decode(str + pos, len - pos, c);
+	if (c == utf8_invalid)
+	{
+		pos += n;
+		return 0x110000u + b;
+	}
+	
+	pos += n;
+	return (uint32_t)utf32chr_to_upper(c);
+}
+
+}
+
+char32_t utf32chr_to_upper(char32_t c)
+{
+	if (c < 0x80u)
+		return (c >= U'a' && c <= U'z') ? c - U'a' + U'A' : c;
+	
+	auto end = std::end(upper_ranges);
+	auto it = std::upper_bound(std::begin(upper_ranges), end, (uint32_t)c,
+		[](uint32_t chr, upper_range const& range) { return chr < range.first; });
+	
+	if (it == std::begin(upper_ranges))
+		return c;
+	--it;
+	
+	if ((uint32_t)c > it->last || ((uint32_t)c - it->first) % it->stride != 0)
+		return c;
+	
+	return (char32_t)((int32_t)c + it->delta);
+}
+
+void utf8_to_upper(char const* str, size_t len, string& out)
+{
+	size_t in = 0, pos = 0, n, upperLen;
+	char32_t c, upper;
+	char buf[4];
+	
+	// Invariant: out.size() - pos >= len - in
+	out.resize(len);
+	
+	for (;;)
+	{
+		n = ascii_upper_run(str + in, len - in, &out[pos]);
+		in += n;
+		pos += n;
+		
+		if (in == len)
+			break;
+		
+		n = utf8_decode(str + in, len - in, c);
+		upper = (c == utf8_invalid ? c : utf32chr_to_upper(c));
+		
+		if (upper == c)
+		{
+			std::memcpy(&out[pos], str + in, n);
+			upperLen = n;
+		}
+		else
+		{
+			upperLen = utf32chr_to_utf8(upper, buf);
+			if (upperLen > n)
+				out.resize(out.size() + upperLen - n);
+			std::memcpy(&out[pos], buf, upperLen);
+		}
+		
+		in += n;
+		pos += upperLen;
+	}
+	
+	out.resize(pos);
+}
+
+void utf8_to_upper_inplace(string& str)
+{
+	size_t len = str.size(), pos = 0, n;
+	char32_t c, upper;
+	char buf[4];
+	
+	while (pos < len)
+	{
+		pos += ascii_upper_run(&str[pos], len - pos, &str[pos]);
+		
+		if (pos == len)
+			break;
+		
+		n = utf8_decode(&str[pos], len - pos, c);
+		upper = (c == utf8_invalid ? c : utf32chr_to_upper(c));
+		
+		if (upper != c)
+		{
+			if (utf32chr_to_utf8(upper, buf) != n)
+			{
+				string tail;
+				utf8_to_upper(str.data() + pos, len - pos, tail);
+				str.replace(pos, string::npos, tail);
+				return;
+			}
+			std::memcpy(&str[pos], buf, n);
+		}
+		
+		pos += n;
+	}
+}
+
+int utf8_compare_nocase(char const* str1, size_t len1, char const* str2, size_t len2)
+{
+	size_t pos1 = 0, pos2 = 0;
+	uint32_t c1, c2;
+	
+	while (pos1 < len1 && pos2 < len2)
+	{
+		if (!(((uint8_t)str1[pos1] | (uint8_t)str2[pos2]) & 0x80u))
+		{
+			c1 = (uint8_t)ascii_upper(str1[pos1++]);
+			c2 = (uint8_t)ascii_upper(str2[pos2++]);
+		}
+		else
+		{
+			c1 = nocase_key(str1, len1, pos1);
+			c2 = nocase_key(str2, len2, pos2);
+		}
+		
+		if (c1 != c2)
+			return c1 < c2 ? -1 : 1;
+	}
+	
+	if (pos1 < len1)
+		return 1;
+	if (pos2 < len2)
+		return -1;
+	return 0;
+}
+
+
+// ~~ UTF-8 validation and conversion ~~
+
+namespace
+{
+
+// Zero-extends ASCII characters to UTF-16
+void ascii_widen(char const* str, size_t len, char16_t* out)
+{
+	size_t i = 0;
+	
+#if defined(__SSE2__)
+	__m128i zero = _mm_setzero_si128();
+	
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((__m128i const*)(str + i));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+#endif
+	
+	for (; i < len; ++i)
+		out[i] = (char16_t)(uint8_t)str[i];
+}
+
+}
+
+size_t utf8_ascii_prefix(char const* str, size_t len)
+{
+	size_t i = 0;
+	
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16)
+	{
+		int mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i const*)(str + i)));
+		if (mask != 0)
+			return i + (size_t)__builtin_ctz((unsigned)mask);
+	}
+#else
+	uint64_t w;
+	
+	for (; i + 8 <= len; i += 8)
+	{
+		std::memcpy(&w, str + i, 8);
+		if (w & ascii_high)
+			break;
+	}
+#endif
+	
+	for (; i < len && !((uint8_t)str[i] & 0x80u); ++i);
+	
+	return i;
+}
+
+bool utf8_validate(char const* str, size_t len, size_t& error_offset)
+{
+	size_t pos = 0;
+	char32_t c;
+	
+	for (;;)
+	{
+		pos += utf8_ascii_prefix(str + pos, len - pos);
+		
+		if (pos == len)
+			return true;
+		
+		size_t n = utf8_decode(str + pos, len - pos, c);
+		if (c == utf8_invalid)
+		{
+			error_offset = pos;
+			return false;
+		}
+		
+		pos += n;
+	}
+}
+
+size_t utf8_to_utf16(char const* str, size_t len, char16_t* out)
+{
+	char16_t* begin = out;
+	size_t pos = 0, n;
+	char32_t c;
+	
+	for (;;)
+	{
+		n = utf8_ascii_prefix(str + pos, len - pos);
+		ascii_widen(str + pos, n, out);
+		pos += n;
+		out += n;
+		
+		if (pos == len)
+			break;
+		
+		pos += utf8_decode(str + pos, len - pos, c);
+		out += utf32chr_to_utf16(c == utf8_invalid ? U'\ufffd' : c, out);
+	}
+	
+	return out - begin;
+}
+
 }
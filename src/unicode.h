@@ -12,6 +12,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <type_traits>
 
 namespace tlmodder
 {
@@ -21,6 +22,15 @@ using std::u16string;
 using std::size_t;
 using std::uint32_t;
 
+enum class UnicodeEncoding {
+	UTF_8,
+	UTF_16LE,
+	UTF_16BE,
+	UTF_32LE,
+	UTF_32BE,
+	UNKNOWN
+};
+
 struct utf8_t     {};
 struct utf16_le_t {};
 struct utf16_be_t {};
@@ -54,11 +64,35 @@ struct utf16_endian_conv<utf16_tag, false>
 	{ return ((chr & UINT16_C(0xff)) << 8) | ((chr >> 8) & UINT16_C(0xff)); }
 };
 
+template<
+	typename utf32_tag,
+	bool is_native = std::is_same<utf32_native_t, utf32_tag>::value
+	>
+struct utf32_endian_conv
+{
+	static inline constexpr char32_t conv(char32_t chr)
+	{ return chr; }
+};
+
+template<
+	typename utf32_tag
+>
+struct utf32_endian_conv<utf32_tag, false>
+{
+	static inline constexpr char32_t conv(char32_t chr)
+	{
+		return ((chr & UINT32_C(0xff)) << 24) | ((chr & UINT32_C(0xff00)) << 8) |
+		       ((chr >> 8) & UINT32_C(0xff00)) | ((chr >> 24) & UINT32_C(0xff));
+	}
+};
+
+// Common part of the iterators below. Iterators are plain classes without
+// virtual methods, code which should work with several encodings takes the
+// iterator type as template parameter, so that next() can be inlined.
 class unicode_iterator
 {
 public:
 	unicode_iterator(): m_replacement(U'\ufffd') {}
-	virtual ~unicode_iterator() {}
 	
 	void set_replacement(char32_t replacement)
 	{ m_replacement = replacement; }
@@ -66,8 +100,9 @@ public:
 	char32_t replacement() const
 	{ return m_replacement; }
 	
-	virtual void reset() = 0;
-	virtual bool next(char32_t& chr_out) = 0;
+	// Iterators implement these:
+	// void reset();
+	// bool next(char32_t& chr_out);
 protected:
 	char32_t m_replacement;
 };
@@ -95,10 +130,10 @@ public:
 		m_cur   = m_begin;
 	}
 	
-	void reset() override
+	void reset()
 	{ m_cur = m_begin; }
 	
-	bool next(char32_t& chr_out) override
+	bool next(char32_t& chr_out)
 	{
 		uint32_t c;
 		
@@ -133,7 +168,7 @@ public:
 				c = (c - 0xd800u) << 10;
 				c |= trail - 0xdc00u;
 				c += 0x10000u;
-				chr_out = (char32_t)trail;
+				chr_out = (char32_t)c;
 			}
 		}
 		
@@ -149,8 +184,112 @@ protected:
 };
 
 
+template<
+	typename utf32_tag = utf32_native_t
+	>
+class utf32_iterator : public unicode_iterator
+{
+public:
+	using char_type = char32_t;
+	
+	utf32_iterator():
+		m_begin(nullptr), m_end(nullptr), m_cur(nullptr)
+	{}
+	
+	utf32_iterator(char32_t const* str, size_t len):
+		m_begin(str), m_end(str+len), m_cur(str)
+	{}
+	
+	void reset()
+	{ m_cur = m_begin; }
+	
+	bool next(char32_t& chr_out)
+	{
+		char32_t c;
+		
+		if (m_cur == m_end)
+			return false;
+		
+		c = utf32_endian_conv<utf32_tag>::conv(*m_cur);
+		++m_cur;
+		
+		// Surrogates and values out of range
+		if ((c > 0xd7ffu && c < 0xe000u) || c > 0x10ffffu)
+			chr_out = m_replacement;
+		else
+			chr_out = c;
+		
+		return true;
+	}
+protected:
+	char32_t const* m_begin;
+	char32_t const* m_end;
+	char32_t const* m_cur;
+};
 
 
+// Set by utf8_decode() for invalid sequences
+const char32_t utf8_invalid = 0xffffffffu;
+
+// Decodes one character of UTF-8 string, len must not be zero. Returns length
+// of the sequence. Overlong forms, surrogates, code points above U+10FFFF and
+// obsolete 5 and 6 byte forms are rejected: chr_out is set to utf8_invalid and
+// length of the maximal invalid subpart is returned, so that one replacement
+// character is produced per broken sequence.
+inline size_t utf8_decode(char const* str, size_t len, char32_t& chr_out)
+{
+	uint8_t const* s = (uint8_t const*)str;
+	uint8_t lo = 0x80u, hi = 0xbfu;  // allowed range of the next continuation byte
+	uint32_t c = s[0];
+	size_t n, i;
+	
+	if (c < 0x80u)
+	{
+		chr_out = (char32_t)c;
+		return 1;
+	}
+	else if (c >= 0xc2u && c <= 0xdfu)
+	{
+		n = 2;
+		c &= 0x1fu;
+	}
+	else if (c >= 0xe0u && c <= 0xefu)
+	{
+		n = 3;
+		c &= 0x0fu;
+		if (s[0] == 0xe0u) lo = 0xa0u;  // overlong
+		if (s[0] == 0xedu) hi = 0x9fu;  // surrogates
+	}
+	else if (c >= 0xf0u && c <= 0xf4u)
+	{
+		n = 4;
+		c &= 0x07u;
+		if (s[0] == 0xf0u) lo = 0x90u;  // overlong
+		if (s[0] == 0xf4u) hi = 0x8fu;  // above U+10FFFF
+	}
+	else
+	{
+		chr_out = utf8_invalid;
+		return 1;
+	}
+	
+	for (i = 1; i < n; ++i)
+	{
+		if (i == len || s[i] < lo || s[i] > hi)
+		{
+			chr_out = utf8_invalid;
+			return i;
+		}
+		
+		c = (c << 6) | (s[i] & 0x3fu);
+		lo = 0x80u;
+		hi = 0xbfu;
+	}
+	
+	chr_out = (char32_t)c;
+	return n;
+}
+
 class utf8_iterator : public unicode_iterator
 {
 public:
@@ -171,10 +310,20 @@ public:
 		m_cur   = m_begin;
 	}
 	
-	void reset() override
+	void reset()
 	{ m_cur = m_begin; }
 	
-	bool next(char32_t& chr_out) override;
+	bool next(char32_t& chr_out)
+	{
+		if (m_cur == m_end)
+			return false;
+		
+		m_cur += utf8_decode(m_cur, m_end - m_cur, chr_out);
+		if (chr_out == utf8_invalid)
+			chr_out = m_replacement;
+		
+		return true;
+	}
 	
 protected:
 	char const* m_begin;
@@ -182,6 +331,11 @@ protected:
 	char const* m_cur;
 };
 
+// Detects encoding of textual data based on BOM, if present, or on position of
+// zero bytes in the first character otherwise (valid DAT files start with ASCII
+// character). Falls back to UTF-8. Size of the BOM is stored in bom_size.
+UnicodeEncoding detect_encoding(uint8_t const* data, size_t size, size_t& bom_size);
+
 // 4 characters must fit in the buffer
 size_t utf32chr_to_utf8(char32_t c, char *buf);
 
@@ -190,18 +344,54 @@ size_t utf32chr_to_utf16(char32_t c, char16_t *buf);
 
 string utf16_to_utf8(char16_t const* utf16str, size_t size);
 
+// Converts UTF-8 string to native-endian UTF-16, invalid sequences are replaced
+// by U+FFFD. Output must have room for len code units, number of code units
+// written is returned.
+size_t utf8_to_utf16(char const* str, size_t len, char16_t* out);
+
+// Returns length of the leading ASCII run of the string, scanning 16 bytes at
+// a time where SSE2 is available
+size_t utf8_ascii_prefix(char const* str, size_t len);
+
+// Checks whether str is valid UTF-8 (see utf8_decode()). If not, offset of
+// the first invalid sequence is stored in error_offset.
+bool utf8_validate(char const* str, size_t len, size_t& error_offset);
+
+inline bool utf8_validate(char const* str, size_t len)
+{
+	size_t error_offset;
+	return utf8_validate(str, len, error_offset);
+}
+
 inline string utf16_to_utf8(u16string const& utf16str)
 { return std::move(utf16_to_utf8(utf16str.c_str(), utf16str.size())); }
 
-// FIXME: for now handle just ASCII
-static inline string utf8_to_upper(string const& str)
+// Simple (one-to-one) upper-case mapping of a single code point. Characters
+// without such mapping (including those whose full mapping expands, like
+// U+00DF) are returned unchanged.
+char32_t utf32chr_to_upper(char32_t c);
+
+// Stores upper-case version of UTF-8 string into out, reusing its capacity.
+// ASCII runs are converted a machine word at a time; invalid sequences are
+// copied unchanged. str must not point into out.
+void utf8_to_upper(char const* str, size_t len, string& out);
+
+// Converts UTF-8 string to upper-case in place. Falls back to reallocating
+// only when some character changes its encoded length.
+void utf8_to_upper_inplace(string& str);
+
+inline string utf8_to_upper(string const& str)
 {
 	string result;
-	for (char c : str)
-		result += (char)::toupper(c);
-	return std::move(result);
+	utf8_to_upper(str.data(), str.size(), result);
+	return result;
 }
 
+// Case-insensitive comparison of UTF-8 strings by upper-cased code points,
+// returns negative, zero or positive value like strcmp. Invalid bytes
+// compare after all valid code points.
+int utf8_compare_nocase(char const* str1, size_t len1, char const* str2, size_t len2);
+
 }
 
 #endif
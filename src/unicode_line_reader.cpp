@@ -8,51 +8,72 @@
 
 #include "unicode_line_reader.h"
 
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
 namespace tlmodder
 {
 
-// ~~ UTF-8 line reader implementation ~~
+// ~~ Stream buffer implementation ~~
 
-utf8_line_reader::utf8_line_reader(char const* ptr, size_t size):
-	m_cur(ptr),
-	m_end(ptr+size)
-{}
+stream_buffer::stream_buffer(int fd, bool close_fd):
+	m_fd(fd),
+	m_close_fd(close_fd),
+	m_eof(false),
+	m_encoding(UnicodeEncoding::UNKNOWN),
+	m_buf(CHUNK_SIZE),
+	m_begin(0),
+	m_end(0)
+{
+	size_t bom_size;
+	
+	// Make sure there is enough data to look at BOM
+	while (m_end < 4 && fill());
+	
+	m_encoding = detect_encoding((uint8_t const*)m_buf.data(), m_end, bom_size);
+	m_begin = bom_size;
+}
+
+stream_buffer::~stream_buffer()
+{
+	if (m_close_fd)
+		::close(m_fd);
+}
 
-bool utf8_line_reader::read_line(string& line)
+bool stream_buffer::fill()
 {
-	char const *line_end;
-	char chr;
+	ssize_t nread;
 	
-	if (m_cur == m_end)
+	if (m_eof)
 		return false;
 	
-	line_end = m_cur;
+	if (m_begin != 0)
+	{
+		std::memmove(m_buf.data(), m_buf.data() + m_begin, m_end - m_begin);
+		m_end -= m_begin;
+		m_begin = 0;
+	}
+	
+	if (m_buf.size() - m_end < CHUNK_SIZE)
+		m_buf.resize(m_buf.size() + CHUNK_SIZE);
 	
-	// Find line end
 	do
 	{
-		chr = *line_end;
-		
-		if (chr == CR || chr == LF)
-			break;
-		
-		++line_end;
-		
-	} while (line_end != m_end);
-	
-	// Assing the line
-	line = string(m_cur, line_end-m_cur);
-	
-	m_cur = line_end;
-	
-	// Support mixed CR, CR+LF and LF line endings
-	if (m_cur != m_end)
+		nread = ::read(m_fd, m_buf.data() + m_end, m_buf.size() - m_end);
+	} while (nread == -1 && errno == EINTR);
+	
+	if (nread == -1)
+		throw std::runtime_error("read() failed");
+	
+	if (nread == 0)
 	{
-		++m_cur;
-		if (chr == CR && m_cur != m_end && *m_cur == LF)
-			++m_cur;
+		m_eof = true;
+		return false;
 	}
 	
+	m_end += (size_t)nread;
 	return true;
 }
 
@@ -11,6 +11,8 @@
 
 #include "unicode.h"
 
+#include <vector>
+
 namespace tlmodder
 {
 
@@ -18,76 +20,185 @@ using std::string;
 using std::size_t;
 
 
-// Abstract class for unicode line readers
-class unicode_line_reader
+// Code unit type, line ending characters and conversion to UTF-8 for each encoding
+template<typename encoding_tag>
+struct unicode_encoding;
+
+template<>
+struct unicode_encoding<utf8_t>
 {
-public:
-	unicode_line_reader() {}
-	virtual ~unicode_line_reader() {}
+	using unit_type = char;
+	
+	static constexpr unit_type CR = '\r';
+	static constexpr unit_type LF = '\n';
 	
-	// This should read a line and set 'line' to UTF-8 encoded line
-	// without line ending characters
-	// Return true if line was read, false if end was reached
-	virtual bool read_line(string& line) = 0;
+	static void decode(unit_type const* ptr, size_t len, string& line)
+	{ line.assign(ptr, len); }
+};
+
+template<typename iter_type>
+struct unicode_encoding_transcoded
+{
+	using unit_type = typename iter_type::char_type;
+	
+	static void decode(unit_type const* ptr, size_t len, string& line)
+	{
+		char32_t utf32chr;
+		char utf8buf[4];
+		iter_type iter(ptr, len);
+		
+		line.clear();
+		while (iter.next(utf32chr))
+			line.append(utf8buf, utf32chr_to_utf8(utf32chr, utf8buf));
+	}
+};
+
+template<>
+struct unicode_encoding<utf16_le_t> : public unicode_encoding_transcoded<utf16_iterator<utf16_le_t>>
+{
+	static constexpr unit_type CR = utf16_endian_conv<utf16_le_t>::conv(u'\r');
+	static constexpr unit_type LF = utf16_endian_conv<utf16_le_t>::conv(u'\n');
+};
+
+template<>
+struct unicode_encoding<utf16_be_t> : public unicode_encoding_transcoded<utf16_iterator<utf16_be_t>>
+{
+	static constexpr unit_type CR = utf16_endian_conv<utf16_be_t>::conv(u'\r');
+	static constexpr unit_type LF = utf16_endian_conv<utf16_be_t>::conv(u'\n');
+};
+
+template<>
+struct unicode_encoding<utf32_le_t> : public unicode_encoding_transcoded<utf32_iterator<utf32_le_t>>
+{
+	static constexpr unit_type CR = utf32_endian_conv<utf32_le_t>::conv(U'\r');
+	static constexpr unit_type LF = utf32_endian_conv<utf32_le_t>::conv(U'\n');
 };
 
+template<>
+struct unicode_encoding<utf32_be_t> : public unicode_encoding_transcoded<utf32_iterator<utf32_be_t>>
+{
+	static constexpr unit_type CR = utf32_endian_conv<utf32_be_t>::conv(U'\r');
+	static constexpr unit_type LF = utf32_endian_conv<utf32_be_t>::conv(U'\n');
+};
 
-// UTF-16 line reader, handles both little-endian and big-endian encodings
+
+// Line reader over text in memory, one instantiation per encoding
+// Line readers have no common base class, code which reads lines takes the
+// reader type as template parameter (see DatFileLoader::_load()).
 // BOM is not handled and must be skipped before passing to line reader
 template<
-	typename utf16_tag = utf16_native_t
+	typename encoding_tag
 	>
-class utf16_line_reader : public unicode_line_reader
+class unicode_line_reader
 {
 public:
-	utf16_line_reader(char16_t const* ptr, size_t size);
-	virtual ~utf16_line_reader() {}
+	using encoding  = unicode_encoding<encoding_tag>;
+	using unit_type = typename encoding::unit_type;
 	
-	bool read_line(string& line) override;
+	unicode_line_reader(unit_type const* ptr, size_t size);
+	
+	// Reads a line and sets 'line' to UTF-8 encoded line without line
+	// ending characters
+	// Returns true if line was read, false if end was reached
+	bool read_line(string& line);
 protected:
-	using endian_conv_type = utf16_endian_conv<utf16_tag>;
-	using iter_type        = utf16_iterator<utf16_tag>;
+	unit_type const* m_cur;
+	unit_type const* m_end;
+};
+
+using utf8_line_reader = unicode_line_reader<utf8_t>;
+
+template<typename utf16_tag = utf16_native_t>
+using utf16_line_reader = unicode_line_reader<utf16_tag>;
+
+template<typename utf32_tag = utf32_native_t>
+using utf32_line_reader = unicode_line_reader<utf32_tag>;
+
+
+// Input of pipes, standard input and other non-mappable files
+// Input is read in fixed-size chunks, encoding is detected from the first chunk
+// (see detect_encoding()) and BOM is skipped. Lines are read from it by
+// stream_line_reader of the detected encoding.
+class stream_buffer
+{
+public:
+	static const size_t CHUNK_SIZE = 64 * 1024;
+	
+	// If close_fd is true, fd will be closed when the buffer is destroyed
+	stream_buffer(int fd, bool close_fd);
+	~stream_buffer();
+	
+	stream_buffer(stream_buffer const&) = delete;
+	stream_buffer& operator=(stream_buffer const&) = delete;
+	
+	UnicodeEncoding encoding() const
+	{ return m_encoding; }
+	
+	// Reads next chunk at the end of the buffer, moving unread data to the front
+	// and growing the buffer if it is full. Returns false at the end of input.
+	bool fill();
+	
+	char const* data() const
+	{ return m_buf.data() + m_begin; }
+	
+	size_t size() const
+	{ return m_end - m_begin; }
 	
-	static const char16_t CR = endian_conv_type::conv(u'\r');
-	static const char16_t LF = endian_conv_type::conv(u'\n');
-	char16_t const* m_cur;
-	char16_t const* m_end;
+	void consume(size_t size)
+	{ m_begin += size; }
+protected:
+	int m_fd;
+	bool m_close_fd;
+	bool m_eof;
+	UnicodeEncoding m_encoding;
+	std::vector<char> m_buf;
+	size_t m_begin;    // start of unread data in m_buf
+	size_t m_end;      // end of valid data in m_buf
 };
 
 
-// UTF-8 line reader
-class utf8_line_reader : public unicode_line_reader
+// Line reader over stream_buffer
+// Incomplete line at the end of a chunk is kept in the buffer until its line
+// ending arrives, so lines (and surrogate pairs within them) split across chunk
+// boundaries are decoded whole.
+template<
+	typename encoding_tag
+	>
+class stream_line_reader
 {
 public:
-	utf8_line_reader(char const* ptr, size_t size);
-	virtual ~utf8_line_reader() {}
+	using encoding  = unicode_encoding<encoding_tag>;
+	using unit_type = typename encoding::unit_type;
 	
-	bool read_line(string& line) override;
+	explicit stream_line_reader(stream_buffer& buf):
+		m_buf(buf),
+		m_skip_lf(false)
+	{}
+	
+	bool read_line(string& line);
 protected:
-	static const char CR = '\r';
-	static const char LF = '\n';
-	char const* m_cur;
-	char const* m_end;
+	stream_buffer& m_buf;
+	bool m_skip_lf;    // last line ended with CR at the end of buffer
 };
 
 
-// ~~ UTF-16 line reader implementation ~~
+// ~~ Line reader implementation ~~
 
 template<
-	typename endian_conv
+	typename encoding_tag
 	>
-utf16_line_reader<endian_conv>::utf16_line_reader(char16_t const* ptr, size_t size):
+unicode_line_reader<encoding_tag>::unicode_line_reader(unit_type const* ptr, size_t size):
 	m_cur(ptr),
 	m_end(ptr+size)
 {}
 
 template<
-	typename endian_conv
+	typename encoding_tag
 	>
-bool utf16_line_reader<endian_conv>::read_line(string& line)
+bool unicode_line_reader<encoding_tag>::read_line(string& line)
 {
-	char16_t const *line_end;
-	char16_t chr;
+	unit_type const *line_end;
+	unit_type chr;
 	
 	if (m_cur == m_end)
 		return false;
@@ -99,7 +210,7 @@ bool utf16_line_reader<endian_conv>::read_line(string& line)
 	{
 		chr = *line_end;
 		
-		if (chr == CR || chr == LF)
+		if (chr == encoding::CR || chr == encoding::LF)
 			break;
 		
 		++line_end;
@@ -107,18 +218,7 @@ bool utf16_line_reader<endian_conv>::read_line(string& line)
 	} while (line_end != m_end);
 	
 	// Convert to UTF-8
-	string utf8str;
-	char32_t utf32chr;
-	char utf8buf[4];
-	size_t utf8len;
-	iter_type iter(m_cur, line_end-m_cur);
-	
-	while (iter.next(utf32chr))
-	{
-		utf8len = utf32chr_to_utf8(utf32chr, utf8buf);
-		utf8str.append(utf8buf, utf8len);
-	}
-	line = std::move(utf8str);
+	encoding::decode(m_cur, line_end-m_cur, line);
 	
 	m_cur = line_end;
 	
@@ -126,13 +226,101 @@ bool utf16_line_reader<endian_conv>::read_line(string& line)
 	if (m_cur != m_end)
 	{
 		++m_cur;
-		if (chr == CR && m_cur != m_end && *m_cur == LF)
+		if (chr == encoding::CR && m_cur != m_end && *m_cur == encoding::LF)
 			++m_cur;
 	}
 	
 	return true;
 }
 
+
+// ~~ Stream line reader implementation ~~
+
+template<
+	typename encoding_tag
+	>
+bool stream_line_reader<encoding_tag>::read_line(string& line)
+{
+	const size_t unit_size = sizeof(unit_type);
+	size_t scanned, line_end;
+	unit_type const* units;
+	unit_type chr = 0;
+	
+	// Previous line ended with CR which was last character in the buffer,
+	// skip LF if it follows
+	if (m_skip_lf)
+	{
+		m_skip_lf = false;
+		
+		if (m_buf.size() < unit_size)
+			while (m_buf.fill() && m_buf.size() < unit_size);
+		
+		if (m_buf.size() >= unit_size &&
+		    *(unit_type const*)m_buf.data() == encoding::LF)
+			m_buf.consume(unit_size);
+	}
+	
+	// Find line end, reading more data if there is none in the buffer
+	for (scanned = 0; ; )
+	{
+		size_t avail = m_buf.size() / unit_size;
+		
+		units = (unit_type const*)m_buf.data();
+		
+		for (line_end = scanned; line_end < avail; ++line_end)
+		{
+			chr = units[line_end];
+			if (chr == encoding::CR || chr == encoding::LF)
+				break;
+		}
+		
+		if (line_end != avail)
+			break;
+		
+		scanned = avail;
+		
+		if (!m_buf.fill())
+		{
+			// Incomplete trailing code unit is dropped
+			if (avail == 0)
+			{
+				m_buf.consume(m_buf.size());
+				return false;
+			}
+			
+			units = (unit_type const*)m_buf.data();
+			break;
+		}
+	}
+	
+	encoding::decode(units, line_end, line);
+	
+	if (line_end == m_buf.size() / unit_size)
+	{
+		// Last line without line ending
+		m_buf.consume(m_buf.size());
+		return true;
+	}
+	
+	m_buf.consume((line_end + 1) * unit_size);
+	
+	// Support mixed CR, CR+LF and LF line endings
+	if (chr == encoding::CR)
+	{
+		if (m_buf.size() >= unit_size)
+		{
+			if (*(unit_type const*)m_buf.data() == encoding::LF)
+				m_buf.consume(unit_size);
+		}
+		else
+		{
+			m_skip_lf = true;
+		}
+	}
+	
+	return true;
+}
+
 }
 
 #endif